@@ -0,0 +1,109 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef DMA_MEMORY_H
+#define DMA_MEMORY_H
+
+#include "CodalConfig.h"
+#include "SAMDDMAC.h"
+
+// Copies and fills shorter than this (in bytes) are left to the CPU, which is quicker
+// once the cost of setting up the DMA channel is counted.
+#ifndef DMA_MEMORY_THRESHOLD
+#define DMA_MEMORY_THRESHOLD 256
+#endif
+
+namespace codal
+{
+
+/**
+ * memcpy() and memset() on a DMA channel, so bulk copies can run while other fibers do.
+ *
+ * A single channel is allocated on first use and serves one operation at a time. Whenever
+ * it is busy, can't be allocated, or the operation is under DMA_MEMORY_THRESHOLD, the CPU
+ * does the work instead, so every copy and fill always succeeds. The blocking calls also
+ * leave it to the CPU from interrupt context or with interrupts disabled.
+ *
+ * Buffers handed to the channel must not be on a fiber's stack: fibers share the stack
+ * memory, so while the caller sleeps (or before an asynchronous call completes) the channel
+ * would be reading or writing some other fiber's data.
+ */
+class DmaMemory
+{
+    public:
+
+    /**
+     * Copies len bytes from src to dst, returning once the copy is complete.
+     * The calling fiber sleeps while the DMA controller does the work.
+     *
+     * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER if the DMA controller hit a bus error.
+     */
+    static int copy(void *dst, const void *src, uint32_t len);
+
+    /**
+     * Sets len bytes at dst to value, returning once the fill is complete.
+     * The calling fiber sleeps while the DMA controller does the work.
+     *
+     * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER if the DMA controller hit a bus error.
+     */
+    static int fill(void *dst, uint8_t value, uint32_t len);
+
+    /**
+     * Starts copying len bytes from src to dst, and returns immediately.
+     *
+     * @param handler called with DMA_COMPLETE or DMA_ERROR once the copy has finished; from
+     *        the DMA interrupt, or before returning if the CPU did the copy.
+     * @param arg passed through to the handler.
+     *
+     * @return DEVICE_OK.
+     */
+    static int copyAsync(void *dst, const void *src, uint32_t len, DmaHandler handler, void *arg);
+
+    /**
+     * Starts setting len bytes at dst to value, and returns immediately.
+     *
+     * @param handler called with DMA_COMPLETE or DMA_ERROR once the fill has finished; from
+     *        the DMA interrupt, or before returning if the CPU did the fill.
+     * @param arg passed through to the handler.
+     *
+     * @return DEVICE_OK.
+     */
+    static int fillAsync(void *dst, uint8_t value, uint32_t len, DmaHandler handler, void *arg);
+
+    /**
+     * Computes the checksum of len bytes at data with the DMA controller's CRC engine,
+     * returning once it is complete. The calling fiber sleeps while the data is read.
+     *
+     * @param type the polynomial to use.
+     * @param result set to the checksum, as read by DmaInstance::getCrc().
+     *
+     * @return DEVICE_OK, DEVICE_BUSY if the channel or the CRC engine is in use elsewhere,
+     *         or DEVICE_INVALID_PARAMETER if the DMA controller hit a bus error.
+     */
+    static int crc(const void *data, uint32_t len, DmaCrcType type, uint32_t &result);
+};
+
+} // namespace codal
+
+#endif
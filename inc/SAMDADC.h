@@ -0,0 +1,338 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CodalConfig.h"
+#include "ZPin.h"
+#include "SAMDDMAC.h"
+#include "SAMDEVSYS.h"
+#include "DataStream.h"
+
+#ifndef SAMDADC_H
+#define SAMDADC_H
+
+#ifndef DEVICE_ID_SYSTEM_ADC
+#define DEVICE_ID_SYSTEM_ADC 34
+#endif
+
+// The number of ADC peripherals.
+#ifdef SAMD21
+#define SAMDADC_INSTANCES 1
+#else
+#define SAMDADC_INSTANCES 2
+#endif
+
+// The most pins a single ADC can scan while streaming.
+#ifndef SAMDADC_MAX_CHANNELS
+#define SAMDADC_MAX_CHANNELS 8
+#endif
+
+// The number of samples in each buffer handed downstream, rounded down to whole scans.
+#ifndef SAMDADC_BUFFER_SAMPLES
+#define SAMDADC_BUFFER_SAMPLES 256
+#endif
+
+#ifndef SAMDADC_DEFAULT_FREQUENCY
+#define SAMDADC_DEFAULT_FREQUENCY 1000
+#endif
+
+// The timer that paces conversions while streaming; chosen to stay clear of SAMDDAC's TC3.
+#ifndef SAMDADC_TC
+#ifdef SAMD21
+#define SAMDADC_TC TC5
+#else
+#define SAMDADC_TC TC2
+#endif
+#endif
+
+// Values for SAMDADCConfig::reference.
+#ifdef SAMD21
+#define SAMDADC_REF_INT1V           ADC_REFCTRL_REFSEL_INT1V_Val    // 1.0V
+#define SAMDADC_REF_VDDANA_DIV1_48  ADC_REFCTRL_REFSEL_INTVCC0_Val  // VDDANA / 1.48
+#define SAMDADC_REF_VDDANA_DIV2     ADC_REFCTRL_REFSEL_INTVCC1_Val  // VDDANA / 2
+#define SAMDADC_REF_AREFA           ADC_REFCTRL_REFSEL_AREFA_Val
+#define SAMDADC_REF_AREFB           ADC_REFCTRL_REFSEL_AREFB_Val
+#define SAMDADC_REF_DEFAULT         SAMDADC_REF_VDDANA_DIV2
+// the input is halved to match the reference, so the full scale is VDDANA.
+#define SAMDADC_GAIN_DEFAULT        ADC_INPUTCTRL_GAIN_DIV2_Val
+#else
+#define SAMDADC_REF_INTREF          ADC_REFCTRL_REFSEL_INTREF_Val   // selected by SUPC VREF
+#define SAMDADC_REF_VDDANA_DIV2     ADC_REFCTRL_REFSEL_INTVCC0_Val  // VDDANA / 2
+#define SAMDADC_REF_VDDANA          ADC_REFCTRL_REFSEL_INTVCC1_Val
+#define SAMDADC_REF_AREFA           ADC_REFCTRL_REFSEL_AREFA_Val
+#define SAMDADC_REF_AREFB           ADC_REFCTRL_REFSEL_AREFB_Val
+#define SAMDADC_REF_AREFC           ADC_REFCTRL_REFSEL_AREFC_Val
+#define SAMDADC_REF_DEFAULT         SAMDADC_REF_VDDANA
+// the SAMD51 has no gain stage.
+#define SAMDADC_GAIN_DEFAULT        0
+#endif
+
+/**
+ * How conversions are made. The ADC is only reprogrammed where this differs from the last
+ * conversion, so pins with different settings can share an ADC at little cost.
+ */
+struct SAMDADCConfig
+{
+    uint8_t     resolution;     // Bits in each result: 8, 10 or 12, or up to 16 when averaging.
+    uint16_t    samples;        // Conversions accumulated per result: 1, 2, 4 ... 1024.
+    uint8_t     sampleTime;     // Extra sampling time in half ADC clock cycles (0 - 63), for high impedance sources.
+    uint8_t     reference;      // One of the SAMDADC_REF_* values.
+    uint8_t     gain;           // INPUTCTRL.GAIN value; SAMD21 only.
+
+    SAMDADCConfig() : resolution(10), samples(1), sampleTime(0),
+                      reference(SAMDADC_REF_DEFAULT), gain(SAMDADC_GAIN_DEFAULT) {}
+};
+
+//
+// Event codes
+//
+#define SAMDADC_DATA_READY 1
+
+/**
+ * Signature of a function called from the ADC interrupt when a watched input leaves its window.
+ *
+ * @param above true if the input has risen above the upper threshold, false if it has fallen
+ *        below the lower one.
+ */
+typedef void (*SAMDADCWindowHandler)(void *arg, bool above);
+
+using namespace codal;
+
+/**
+ * Driver for the SAMD analogue to digital converter.
+ *
+ * The ADC is configured once, on first use, and stays configured: single conversions only
+ * select the input and run. Alternatively a list of pins can be streamed: a timer starts
+ * each conversion through the event system, one DMA channel collects the results and
+ * (when scanning several pins) another selects the next input as each result lands,
+ * so no interrupts are taken per sample.
+ */
+class SAMDADC : public CodalComponent, public DmaComponent, public DataSource
+{
+    Adc*            adc;
+    int             index;                                  // position of adc in the instances, 0 or 1.
+    bool            enabled;                                // Determines if this component is actively streaming.
+    int             sampleRate;                             // Scans per second while streaming.
+    uint32_t        overruns;
+
+    uint8_t         inputs[SAMDADC_MAX_CHANNELS];           // MUXPOS of each pin to stream, in order.
+    int             inputCount;
+    ADC_INPUTCTRL_Type scanTable[SAMDADC_MAX_CHANNELS];     // INPUTCTRL values written by scanDma.
+
+    uint16_t*       raw[2];                                 // Double buffer written by resultDma.
+    volatile int    filling;                                // The raw buffer resultDma is writing to.
+    volatile int    ready;                                  // The raw buffer waiting to go downstream, or -1.
+    uint32_t        rawSize;                                // The size of each raw buffer in bytes.
+    ManagedBuffer   buffer;
+
+    SAMDADCConfig   current;                                // As the hardware is configured now.
+    SAMDADCConfig   streamConfig;
+
+    // the input watched by the window monitor, see startWindow().
+    SAMDADCWindowHandler windowHandler;
+    void*           windowArg;
+    int             windowInput;
+    volatile bool   windowAbove;                            // true if waiting for the input to fall.
+
+    Tc*             tc;
+    DmaInstance*    resultDma;
+    DmaInstance*    scanDma;
+    EvsysChannel*   startEvent;                             // Timer overflow to ADC start.
+    EvsysChannel*   scanEvent;                              // Result ready to scanDma.
+
+    static SAMDADC* instances[SAMDADC_INSTANCES];
+
+    bool apply(const SAMDADCConfig &config);
+    void release();
+    void sendData(Event);
+
+public:
+
+    DataStream output;
+
+    /**
+     * Constructor for an instance of the ADC. Use getInstance() rather than this, so all users
+     * of an ADC share its configuration.
+     *
+     * @param index 0 for ADC (SAMD21) or ADC0 (SAMD51), 1 for ADC1.
+     * @param id The id to use for the message bus when transmitting events.
+     */
+    SAMDADC(int index, uint16_t id = DEVICE_ID_SYSTEM_ADC);
+
+    /**
+     * Provides the shared instance of the given ADC, creating and configuring it if need be.
+     *
+     * @param index 0 for ADC (SAMD21) or ADC0 (SAMD51), 1 for ADC1.
+     */
+    static SAMDADC* getInstance(int index);
+
+    /**
+     * Finds the ADC and input connected to the given pin.
+     *
+     * @param name the pin.
+     * @param adc set to the ADC instance that can sample the pin.
+     *
+     * @return the MUXPOS input number of the pin, or DEVICE_NOT_SUPPORTED if it has none.
+     */
+    static int lookup(PinNumber name, SAMDADC *&adc);
+
+    /**
+     * Determines whether a configuration can be used.
+     */
+    static bool isValid(const SAMDADCConfig &config);
+
+    /**
+     * Performs a single conversion with the default configuration.
+     *
+     * @param input the MUXPOS input number to convert, as provided by lookup().
+     *
+     * @return the result, in the range 0 - 1023, or DEVICE_BUSY if this ADC is streaming.
+     */
+    int read(int input);
+
+    /**
+     * Performs a single conversion. When averaging, the ADC accumulates the given number of
+     * samples in hardware and the result is scaled to the requested resolution, so averaging
+     * 4^n samples yields up to n extra bits.
+     *
+     * @param input the MUXPOS input number to convert, as provided by lookup().
+     * @param config how to convert.
+     *
+     * @return the result, in the range 0 - (2^config.resolution - 1), DEVICE_INVALID_PARAMETER
+     *         if the configuration isn't valid, or DEVICE_BUSY if this ADC is streaming or
+     *         watching another input.
+     */
+    int read(int input, const SAMDADCConfig &config);
+
+    /**
+     * Sets how conversions are made while streaming. Streamed samples are the ADC's raw
+     * results: of the given resolution when not averaging, and 16 bits (or 12 plus log2 of
+     * samples, if that's less) when averaging.
+     *
+     * @return DEVICE_OK, DEVICE_INVALID_PARAMETER if the configuration isn't valid, or
+     *         DEVICE_BUSY if this ADC is streaming.
+     */
+    int configureStream(const SAMDADCConfig &config);
+
+    /**
+     * Converts the given input over and over in the background, and calls the handler whenever
+     * the result rises above high or falls below low. Having risen, it has to fall below low
+     * before rising again counts, and vice versa, so the gap between the two acts as hysteresis.
+     *
+     * While the window monitor runs, reads of the watched input return its latest result
+     * and other inputs can't be read.
+     *
+     * @param input the MUXPOS input number to watch, as provided by lookup().
+     * @param config how to convert; the thresholds are in units of its resolution.
+     * @param low the lower threshold.
+     * @param high the upper threshold, no less than low.
+     * @param handler called from the ADC interrupt on each crossing.
+     * @param arg passed through to the handler, and identifying the watcher to stopWindow().
+     *
+     * @return DEVICE_OK, DEVICE_INVALID_PARAMETER if the configuration or thresholds aren't
+     *         valid, or DEVICE_BUSY if this ADC is streaming or watching for someone else.
+     */
+    int startWindow(int input, const SAMDADCConfig &config, int low, int high, SAMDADCWindowHandler handler, void *arg);
+
+    /**
+     * Stops the window monitor, if it was started with the given argument.
+     */
+    void stopWindow(void *arg);
+
+    /**
+     * Called from the ADC interrupt.
+     */
+    void windowInterrupt();
+
+    /**
+     * Adds a pin to the list streamed by enable(). The pin is put into analogue input mode.
+     *
+     * @return DEVICE_OK, DEVICE_INVALID_PARAMETER if the pin isn't connected to this ADC,
+     *         DEVICE_NO_RESOURCES if SAMDADC_MAX_CHANNELS pins have been added already, or
+     *         DEVICE_BUSY if this ADC is streaming.
+     */
+    int addChannel(ZPin &pin);
+
+    /**
+     * Empties the list of pins streamed by enable().
+     *
+     * @return DEVICE_OK, or DEVICE_BUSY if this ADC is streaming.
+     */
+    int clearChannels();
+
+    /**
+     * Change the rate at which the pins are sampled while streaming. Each pin is sampled at this rate,
+     * so the ADC converts at the rate times the number of pins.
+     * n.b. The conversion period is a whole number of timer ticks, which are 125nS long for
+     * conversion rates above 122Hz and get coarser below that, down to about 0.12Hz.
+     *
+     * @param frequency The new sample rate, per pin, in Hz.
+     *
+     * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER if the timer can't run at the resulting
+     *         conversion rate.
+     */
+    int setSampleRate(int frequency);
+
+    /**
+     * Provides the rate at which each pin is sampled while streaming.
+     */
+    int getSampleRate();
+
+    /**
+     * Starts streaming samples of the pins given to addChannel() to the output stream. Each buffer
+     * holds 16 bit samples, one per pin in the order they were added, repeated for successive scans.
+     *
+     * @return DEVICE_OK, DEVICE_INVALID_STATE if no pins have been added, DEVICE_BUSY if the
+     *         window monitor is running, DEVICE_NO_RESOURCES if the DMA channels or event
+     *         channels needed aren't available, or DEVICE_INVALID_PARAMETER if the sample rate
+     *         is out of reach with this many pins.
+     */
+    int enable();
+
+    /**
+     * Stops streaming, and releases the timer, DMA and event channels.
+     */
+    void disable();
+
+    /**
+     * @return the number of buffers dropped because the previous one was still waiting to be sent.
+     */
+    uint32_t getOverruns();
+
+    /**
+     * Provide the next available ManagedBuffer to our downstream caller, if available.
+     */
+    virtual ManagedBuffer pull();
+
+    /**
+     * Update our reference to a downstream component.
+     */
+    virtual void connect(DataSink &sink);
+
+    /**
+     * Interrupt callback when a raw buffer has been filled.
+     */
+    virtual void dmaTransferComplete(DmaCode c);
+};
+
+#endif
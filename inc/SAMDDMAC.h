@@ -31,7 +31,11 @@ DEALINGS IN THE SOFTWARE.
 #define SAMDDMAC_H
 
 #define DMA_DESCRIPTOR_ALIGNMENT 16 // SAMD21 Datasheet 20.8.15 and 20.8.16
-#define DMA_DESCRIPTOR_COUNT 8
+
+// One descriptor (and one write-back descriptor) per hardware channel, unless a target asks for fewer.
+#ifndef DMA_DESCRIPTOR_COUNT
+#define DMA_DESCRIPTOR_COUNT DMAC_CH_NUM
+#endif
 
 namespace codal
 {
@@ -49,25 +53,127 @@ enum DmaBeatSize
     BeatWord
 };
 
+/**
+ * Arbitration priority of a DMA channel; pending requests on a higher level are always
+ * serviced before those on a lower one.
+ */
+enum DmaPriority
+{
+    DmaPriorityLow = 0,
+    DmaPriorityMedium,
+    DmaPriorityHigh,
+    DmaPriorityHighest
+};
+
 class DmaComponent
 {
 public:
     virtual void dmaTransferComplete(DmaCode c);
 };
 
+/**
+ * What an incoming event does to a DMA channel (see SAMDEVSYS.h for routing events to it).
+ */
+enum DmaEventAction
+{
+    DmaEventNone = 0,
+    DmaEventTrigger,             // each event acts as the channel's trigger
+    DmaEventConditionalTrigger,  // peripheral triggers only count while the event is active
+    DmaEventConditionalBlock,    // block transfers only proceed while the event is active
+    DmaEventSuspend,
+    DmaEventResume,
+    DmaEventSkip                 // skip the next block
+};
+
+/**
+ * Polynomial used by the DMA controller's CRC engine.
+ */
+enum DmaCrcType
+{
+    DmaCrc16 = 0,   // CRC-16 (CCITT), seeded with 0xFFFF
+    DmaCrc32        // CRC-32 (IEEE 802.3), seeded with 0xFFFFFFFF
+};
+
+/**
+ * Signature of a function called directly from the DMA interrupt when a channel completes.
+ */
+typedef void (*DmaHandler)(void *arg, DmaCode c);
+
+/**
+ * A DmaHandler that passes the completion on to arg's dmaTransferComplete(), e.g.
+ * dma->onTransferComplete(dma_member_handler<ZSPI>, this). The call is still virtual, so
+ * subclasses overriding dmaTransferComplete() see their own version.
+ */
+template <class T> void dma_member_handler(void *arg, DmaCode c)
+{
+    ((T *)arg)->dmaTransferComplete(c);
+}
+
 static inline int sercom_trigger_src(int sercomIdx, bool tx)
 {
     return SERCOM0_DMAC_ID_RX + sercomIdx * 2 + (tx ? 1 : 0);
 }
 
+/**
+ * @return the trigger source of the given TC's overflow, the index being its position in tc_insts[].
+ */
+static inline int tc_overflow_trigger_src(int tcIdx)
+{
+#ifdef SAMD21
+    return TC3_DMAC_ID_OVF + tcIdx * 3;
+#else
+    return TC0_DMAC_ID_OVF + tcIdx * 3;
+#endif
+}
+
+/**
+ * @return the trigger source of the given TCC's overflow, the index being its position in tcc_insts[].
+ */
+static inline int tcc_overflow_trigger_src(int tccIdx)
+{
+#ifdef SAMD21
+    return TCC0_DMAC_ID_OVF + tccIdx * 4;
+#else
+    // the TCCs have different numbers of compare channels, each with its own trigger.
+    static const uint8_t triggers[] = { TCC0_DMAC_ID_OVF, TCC1_DMAC_ID_OVF, TCC2_DMAC_ID_OVF,
+                                        TCC3_DMAC_ID_OVF, TCC4_DMAC_ID_OVF };
+    return triggers[tccIdx];
+#endif
+}
+
 class DmaInstance
 {
-    uint32_t bufferSize;
+    uint32_t bufferSize; // in beats
+    DmaPriority priority;
+
+    // state of a circular transfer, see startCircular().
+    uint8_t *circularBuffer;
+    uint32_t circularSize;       // zero unless a circular transfer is running
+    volatile uint32_t circularWraps;
+    uint32_t circularRead;       // total bytes consumed
+    uint32_t circularLast;       // total bytes written, as last seen
+    uint32_t circularOverruns;
+
+    uint32_t getCircularWritten();
+
+    /**
+     * Disables the channel and sets its descriptor up for a one-shot transfer of len bytes,
+     * leaving it to the caller to enable it.
+     */
+    void prepareTransfer(const void *src_addr, void *dst_addr, uint32_t len);
+
     public:
     int channel_number;
     DmaComponent* cb;
 
-    DmaInstance(int channel);
+    DmaInstance(int channel, DmaPriority priority = DmaPriorityLow);
+
+    /**
+     * Sets the arbitration priority of this channel. Takes effect on the next call to configure().
+     */
+    void setPriority(DmaPriority priority);
+
+    DmaPriority getPriority();
 
     /**
      * Disables this DMA instance.
@@ -90,21 +196,139 @@ class DmaInstance
      */
     int onTransferComplete(DmaComponent *component);
 
+    /**
+     * Registers a function to be called directly from the DMA interrupt upon transfer completion,
+     * replacing any component registered previously.
+     *
+     * @param handler the function to call, or NULL to stop receiving notifications.
+     * @param arg passed through to the handler.
+     *
+     * @return DEVICE_OK.
+     */
+    int onTransferComplete(DmaHandler handler, void *arg);
+
     void abort();
 
     void transfer(const void *from, void *to, uint32_t len);
 
     void configure(uint8_t trig_src, DmaBeatSize beat_size, volatile void *src_addr, volatile void *dst_addr);
 
+    /**
+     * Sets what an event routed to this channel does. Call after configure(), which resets it.
+     *
+     * @param action the action to take on each event, or DmaEventNone to ignore events.
+     */
+    void setEventInput(DmaEventAction action);
+
+    /**
+     * Configures this channel for memory to memory transfers, each moved as a single block
+     * once started with softwareTrigger(). The beat size and address increments are taken
+     * from the descriptor, so may be changed between transfers.
+     */
+    void configureMemory();
+
+    /**
+     * Starts the transfer set up by the last call to transfer(), for channels with no peripheral trigger.
+     */
+    void softwareTrigger();
+
     DmacDescriptor& getDescriptor();
     DmacDescriptor& getWriteBackDescriptor();
 
     void setDescriptor(DmacDescriptor* d);
 
+    /**
+     * Determines how much of the current transfer has completed. Safe to call at any time,
+     * including while the channel is running.
+     *
+     * @return the number of bytes transferred so far.
+     */
     int getBytesTransferred();
 
+    /**
+     * Starts receiving from the peripheral given to configure() into a ring buffer, which the
+     * channel fills over and over until abort() is called. The completion handler is called
+     * each time the channel wraps back to the start of the buffer.
+     *
+     * A channel that reads from memory instead sends the buffer to the peripheral over and over.
+     *
+     * @param buffer the ring buffer.
+     * @param len the size of the buffer in bytes, a multiple of the beat size.
+     * @param notify false to go without the interrupt at each wrap, for rings that are never
+     *        read back with circularPeek() (which relies on it to count laps).
+     *
+     * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER if the channel doesn't move memory.
+     */
+    int startCircular(void *buffer, uint32_t len, bool notify = true);
+
+    /**
+     * Provides the data that has landed in the ring buffer but not been consumed yet.
+     * If the channel has lapped the reader, the unread data is dropped and counted as an overrun.
+     *
+     * @param data set to the oldest unconsumed byte.
+     *
+     * @return the number of unconsumed bytes contiguous from data (the rest follows from the
+     *         start of the buffer), or DEVICE_INVALID_STATE if no circular transfer is running.
+     */
+    int circularPeek(uint8_t *&data);
+
+    /**
+     * Marks data provided by circularPeek() as consumed, making room for the channel.
+     *
+     * @param len the number of bytes consumed.
+     */
+    void circularConsume(uint32_t len);
+
+    /**
+     * @return the number of times the channel has overwritten unread data in the ring buffer.
+     */
+    uint32_t getCircularOverruns();
+
+    /**
+     * Attaches the DMA controller's CRC engine to this channel, so every beat the channel
+     * moves from then on is added to a checksum at no cost to the CPU. The controller has a
+     * single CRC engine, so only one channel may use it at a time.
+     *
+     * Call once the descriptor's beat size is set (the engine consumes whole beats), and
+     * again to restart the checksum before each new piece of data.
+     *
+     * @param type the polynomial to use.
+     *
+     * @return DEVICE_OK, or DEVICE_BUSY if another channel is using the CRC engine.
+     */
+    int enableCrc(DmaCrcType type);
+
+    /**
+     * Reads the checksum of everything moved since enableCrc(), normally once the transfer
+     * completes. This is the raw contents of the checksum register.
+     *
+     * @return the checksum, or zero if this channel doesn't have the CRC engine.
+     */
+    uint32_t getCrc();
+
+    /**
+     * Detaches the CRC engine from this channel, making it available to others.
+     */
+    void disableCrc();
+
+    /**
+     * Called from the DMA interrupt each time a block completes.
+     */
+    void blockCompleted()
+    {
+        if (circularSize)
+            circularWraps++;
+    }
+
     void trigger(DmaCode c);
 
+    /**
+     * DmaFactory hands out at most one instance per channel, so instances come from a fixed
+     * pool rather than the heap, and can be created and deleted from any context.
+     */
+    static void *operator new(size_t size);
+    static void operator delete(void *p);
+
     ~DmaInstance();
 };
 
@@ -146,6 +370,10 @@ class DmaFactory
     static DmaControllerInstance* instance;
     static DmaInstance* apps[DMA_DESCRIPTOR_COUNT];
 
+    // completion handlers indexed by channel, called straight from the DMA interrupt.
+    static DmaHandler handlers[DMA_DESCRIPTOR_COUNT];
+    static void* handlerArgs[DMA_DESCRIPTOR_COUNT];
+
     /**
      * Disables all confgures DMA activity.
      * Typically required before configuring DMA descriptors and DMA channels.
@@ -157,7 +385,13 @@ class DmaFactory
      */
     static void enable();
 
-    static DmaInstance* allocate();
+    /**
+     * Allocates an unused DMA channel, if one is available.
+     *
+     * @param priority the arbitration priority of the channel.
+     * @return a new DmaInstance, or NULL if all DMA_DESCRIPTOR_COUNT channels are in use.
+     */
+    static DmaInstance* allocate(DmaPriority priority = DmaPriorityLow);
 
     static void setDescriptor(int channel, DmacDescriptor*);
 
@@ -29,6 +29,12 @@ DEALINGS IN THE SOFTWARE.
 
 #define EIC_CHANNEL_COUNT           16
 
+// Debouncing (SAMD51) samples the lines at CLK_ULP32K / 2^(EIC_DEBOUNCE_PRESCALER + 1), and
+// needs 7 equal samples before an edge is seen: around 7ms by default.
+#ifndef EIC_DEBOUNCE_PRESCALER
+#define EIC_DEBOUNCE_PRESCALER      4
+#endif
+
 #ifndef SAMDEIC_H
 #define SAMDEIC_H
 
@@ -51,20 +57,40 @@ class EICInterface
     virtual void pinEventDetected();
 };
 
+/**
+ * Signature of a function called from the EIC interrupt when its line sees an event, with the
+ * level of the line's pin sampled on entry to the interrupt.
+ */
+typedef void (*EICLineHandler)(void *arg, bool level);
+
+/**
+ * The filtering applied to an EIC line before its edges are detected.
+ */
+enum EICFilter
+{
+    EICFilterNone = 0,
+    EICFilterMajority,      // majority of three samples of the EIC clock, to reject glitches.
+    EICFilterDebounce       // a level has to hold for seven ticks of the debouncer (SAMD51 only).
+};
+
 class EICChannel
 {
     int channel_number; // the channel
     EICEventType configuration;
+    EICFilter filter;
 
     public:
     EICInterface* cb;
 
     /**
-     * Create an EIC channel given a channel number
-     *
-     * @param channel the channel to use
+     * Create an unused EIC channel. Channels are held by EICFactory, one per line.
+     **/
+    EICChannel();
+
+    /**
+     * Returns the number of this channel.
      **/
-    EICChannel(int channel);
+    int getChannel();
 
     /**
      * Configures this instance given a type.
@@ -90,6 +116,15 @@ class EICChannel
      **/
     void enable(EICEventType t);
 
+    /**
+     * Sets the filtering of this channel, applied from the next call to configure() or enable().
+     *
+     * @param f the filter.
+     *
+     * @return DEVICE_OK, or DEVICE_NOT_SUPPORTED if the part has no such filter.
+     **/
+    int setFilter(EICFilter f);
+
     /**
      * Called by the interrupt handler when an interrupt is received.
      **/
@@ -101,6 +136,17 @@ class EICChannel
      * @param interface the EICinterface to invoke.
      **/
     void setChangeCallback(EICInterface* interface);
+
+    /**
+     * Sets the function called straight from the interrupt on each event, in place of any
+     * EICInterface. The level passed to it is read from the given pin, which should be the
+     * one muxed to this channel.
+     *
+     * @param handler the function to call, or NULL for none.
+     * @param arg passed to the handler.
+     * @param pin the pin whose level is passed to the handler.
+     **/
+    void setHandler(EICLineHandler handler, void *arg, int pin);
 };
 
 class EICFactory
@@ -114,7 +160,8 @@ class EICFactory
 
     public:
 
-    static EICChannel* instances[EIC_CHANNEL_COUNT]; // EIC channel instances.
+    static EICChannel channels[EIC_CHANNEL_COUNT];   // one per line, so none are ever allocated.
+    static EICChannel* instances[EIC_CHANNEL_COUNT]; // the channels in use, or NULL.
     static EICFactory* instance;    // singleton reference
 
     static EICFactory* getInstance();
@@ -146,6 +193,21 @@ class EICFactory
     void free(int channel);
 };
 
+/**
+ * Passes the level of an EIC line's pin on to the event system, without interrupting, bringing
+ * the EIC up if needed. The pin has to be muxed to the EIC (function A).
+ *
+ * @param channel the EIC line.
+ *
+ * @return DEVICE_OK, or DEVICE_BUSY if the line is in use.
+ */
+int eic_enable_level_event(int channel);
+
+/**
+ * Stops an EIC line started by eic_enable_level_event().
+ */
+void eic_disable_level_event(int channel);
+
 } // namespace codal
 
 #endif
@@ -0,0 +1,255 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CodalConfig.h"
+#include "sam.h"
+
+#ifndef SAMDEVSYS_H
+#define SAMDEVSYS_H
+
+#ifndef EVSYS_CHANNEL_COUNT
+#define EVSYS_CHANNEL_COUNT EVSYS_CHANNELS
+#endif
+
+// the channels that can detect edges and raise interrupts (all of them on SAMD21, the first 12 on SAMD51).
+#ifdef SAMD21
+#define EVSYS_SYNC_CHANNEL_COUNT EVSYS_CHANNELS
+#else
+#define EVSYS_SYNC_CHANNEL_COUNT 12
+#endif
+
+namespace codal
+{
+
+/**
+ * How an event travels from generator to users.
+ * Only the synchronous and resynchronized paths can detect edges or raise interrupts,
+ * while the asynchronous path has the lowest latency and works without a clock.
+ */
+enum EvsysPath
+{
+    EvsysPathSync = 0,
+    EvsysPathResync,
+    EvsysPathAsync
+};
+
+/**
+ * Which edges of the generator's signal produce events (synchronous and resynchronized paths only).
+ * Pulse generators such as timer overflows use EvsysEdgeRise, which is also the default on those paths.
+ */
+enum EvsysEdge
+{
+    EvsysEdgeNone = 0,
+    EvsysEdgeRise,
+    EvsysEdgeFall,
+    EvsysEdgeBoth
+};
+
+/**
+ * Signature of a function called from the EVSYS interrupt when an event is detected on a channel.
+ */
+typedef void (*EvsysHandler)(void *arg);
+
+/**
+ * Generator and user numbers of common peripherals, for use with EvsysChannel.
+ * TC indices are positions in tc_insts[], as used by the timer drivers.
+ */
+static inline int tc_overflow_event_gen(int tcIdx)
+{
+#ifdef SAMD21
+    return EVSYS_ID_GEN_TC3_OVF + tcIdx * 3;
+#else
+    return EVSYS_ID_GEN_TC0_OVF + tcIdx * 3;
+#endif
+}
+
+static inline int tc_event_user(int tcIdx)
+{
+#ifdef SAMD21
+    return EVSYS_ID_USER_TC3_EVU + tcIdx;
+#else
+    return EVSYS_ID_USER_TC0_EVU + tcIdx;
+#endif
+}
+
+/**
+ * @return the user number of event input n (0 or 1) of the given TCC, the index being its
+ * position in tcc_insts[].
+ */
+static inline int tcc_event_user(int tccIdx, int n)
+{
+#ifdef SAMD21
+    static const uint8_t users[] = { EVSYS_ID_USER_TCC0_EV_0, EVSYS_ID_USER_TCC1_EV_0, EVSYS_ID_USER_TCC2_EV_0 };
+#else
+    static const uint8_t users[] = { EVSYS_ID_USER_TCC0_EV_0, EVSYS_ID_USER_TCC1_EV_0, EVSYS_ID_USER_TCC2_EV_0,
+                                     EVSYS_ID_USER_TCC3_EV_0, EVSYS_ID_USER_TCC4_EV_0 };
+#endif
+    return users[tccIdx] + n;
+}
+
+static inline int eic_event_gen(int extint)
+{
+    return EVSYS_ID_GEN_EIC_EXTINT_0 + extint;
+}
+
+static inline int adc_start_event_user(int adcIdx = 0)
+{
+#ifdef SAMD21
+    return EVSYS_ID_USER_ADC_START;
+#else
+    return adcIdx ? EVSYS_ID_USER_ADC1_START : EVSYS_ID_USER_ADC0_START;
+#endif
+}
+
+static inline int adc_resrdy_event_gen(int adcIdx = 0)
+{
+#ifdef SAMD21
+    return EVSYS_ID_GEN_ADC_RESRDY;
+#else
+    return adcIdx ? EVSYS_ID_GEN_ADC1_RESRDY : EVSYS_ID_GEN_ADC0_RESRDY;
+#endif
+}
+
+static inline int dac_start_event_user()
+{
+#ifdef SAMD21
+    return EVSYS_ID_USER_DAC_START;
+#else
+    return EVSYS_ID_USER_DAC_START_0;
+#endif
+}
+
+/**
+ * @return the user number of the given DMA channel's event input, or -1 if the channel has none
+ * (only channels 0-3 on SAMD21, and 0-7 on SAMD51, accept events).
+ */
+static inline int dma_event_user(int dmaChannel)
+{
+#ifdef SAMD21
+    return dmaChannel < 4 ? EVSYS_ID_USER_DMAC_CH_0 + dmaChannel : -1;
+#else
+    return dmaChannel < 8 ? EVSYS_ID_USER_DMAC_CH_0 + dmaChannel : -1;
+#endif
+}
+
+class EvsysChannel
+{
+    int channel_number;
+    uint32_t configuration; // the CHANNEL register value, less any software event.
+
+    public:
+
+    /**
+     * Create an event channel given a channel number. Use EvsysFactory::allocate() rather than this.
+     *
+     * @param channel the channel to use
+     **/
+    EvsysChannel(int channel);
+
+    /**
+     * Connects a generator to this channel.
+     *
+     * @param generator the EVSYS_ID_GEN_* number of the event source, or 0 to disconnect.
+     * @param path how the event reaches the users.
+     * @param edge the edges that produce events, for level generators on a synchronous or resynchronized path.
+     *
+     * @return DEVICE_OK, or DEVICE_NOT_SUPPORTED if this channel can't use the requested path.
+     **/
+    int setGenerator(int generator, EvsysPath path = EvsysPathAsync, EvsysEdge edge = EvsysEdgeNone);
+
+    /**
+     * Routes this channel to the given user; a user listens to at most one channel.
+     *
+     * @param user the EVSYS_ID_USER_* number of the event consumer.
+     *
+     * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER if the user number is out of range.
+     **/
+    int addUser(int user);
+
+    /**
+     * Stops the given user listening to this channel.
+     *
+     * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER if the user isn't listening to this channel.
+     **/
+    int removeUser(int user);
+
+    /**
+     * Generates an event on this channel from software.
+     **/
+    void trigger();
+
+    /**
+     * Registers a function to be called from the EVSYS interrupt whenever an event is detected
+     * on this channel. The channel must be using a synchronous or resynchronized path.
+     *
+     * @param handler the function to call, or NULL to disable the interrupt.
+     * @param arg passed through to the handler.
+     *
+     * @return DEVICE_OK, or DEVICE_NOT_SUPPORTED if this channel can't raise interrupts.
+     **/
+    int onEventDetected(EvsysHandler handler, void *arg);
+
+    /**
+     * Retrieves the hardware channel number.
+     **/
+    int getChannel();
+
+    /**
+     * Disconnects the generator and all users of this channel, and returns it to the factory.
+     **/
+    ~EvsysChannel();
+};
+
+class EvsysFactory
+{
+    static void instantiate();
+
+    public:
+
+    static bool initialised;
+    static EvsysChannel* channels[EVSYS_CHANNEL_COUNT];
+
+    // event handlers indexed by channel, called straight from the EVSYS interrupt.
+    static EvsysHandler handlers[EVSYS_SYNC_CHANNEL_COUNT];
+    static void* handlerArgs[EVSYS_SYNC_CHANNEL_COUNT];
+
+    /**
+     * Allocates an unused event channel, if one is available.
+     *
+     * @param synchronous true if the channel will need a synchronous or resynchronized path, i.e. to
+     *        detect edges or raise interrupts. Otherwise channels that can't are handed out first.
+     *
+     * @return a new EvsysChannel, or NULL if no suitable channel is free.
+     **/
+    static EvsysChannel* allocate(bool synchronous = false);
+
+    /**
+     * Returns a channel to the pool; called by the EvsysChannel destructor.
+     **/
+    static void free(EvsysChannel* channel);
+};
+
+} // namespace codal
+
+#endif
@@ -0,0 +1,171 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SAMD_USB_H
+#define SAMD_USB_H
+
+#include "CodalUSB.h"
+
+#if CONFIG_ENABLED(DEVICE_USB)
+
+// Set to 1 to keep transfer counters and timings in the USB driver, see usb_endpoint_stats().
+#ifndef DEVICE_USB_STATS
+#define DEVICE_USB_STATS 0
+#endif
+
+// The most usb_write_async() writes that can be pending on one endpoint.
+#ifndef USB_ASYNC_WRITES_PER_EP
+#define USB_ASYNC_WRITES_PER_EP 4
+#endif
+
+/**
+ * SAMD specific extensions to the CodalUSB endpoint API.
+ */
+
+/**
+ * Callback invoked (in interrupt context) when a direct read completes.
+ *
+ * @param ep the endpoint the data was received on.
+ * @param arg the argument given to usb_read_direct().
+ * @param len the number of bytes written to the buffer, or DEVICE_CANCELLED if the
+ *            read was aborted by an endpoint or bus reset.
+ */
+typedef void (*UsbReadCallback)(UsbEndpointOut *ep, void *arg, int len);
+
+// The largest single direct read; BYTE_COUNT and MULTI_PACKET_SIZE are 14 bits wide.
+#define USB_MAX_DIRECT_READ 16320
+
+/**
+ * Arms the OUT bank of the given endpoint to receive straight into the supplied buffer,
+ * without going through the endpoint's own packet buffer.
+ *
+ * The hardware receives packets back-to-back until len bytes have arrived or the host
+ * sends a short packet, at which point the callback is invoked. While a direct read is
+ * pending, UsbEndpointOut::read() returns no data.
+ *
+ * @param ep the (non-control) endpoint to read from.
+ * @param dst a word aligned buffer in RAM, which must remain valid until the callback runs.
+ *            It must not be on a fiber's stack, as fibers share the stack memory.
+ * @param len the buffer size; a non-zero multiple of 64, no larger than USB_MAX_DIRECT_READ.
+ * @param cb the function to call on completion.
+ * @param arg passed through to the callback.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the buffer is unsuitable, or
+ *         DEVICE_BUSY if a read is already pending or a packet is waiting in the endpoint buffer.
+ */
+int usb_read_direct(UsbEndpointOut *ep, void *dst, int len, UsbReadCallback cb, void *arg);
+
+/**
+ * Aborts a pending direct read. The callback is invoked with DEVICE_CANCELLED.
+ *
+ * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER if no direct read is pending.
+ */
+int usb_read_direct_cancel(UsbEndpointOut *ep);
+
+/**
+ * Callback invoked (in interrupt context) when an asynchronous write completes.
+ *
+ * @param ep the endpoint the data was sent on.
+ * @param arg the argument given to usb_write_async().
+ * @param status DEVICE_OK once the host has taken all the data, or DEVICE_CANCELLED if
+ *               the write was dropped by an endpoint reset, stall or bus reset.
+ */
+typedef void (*UsbWriteCallback)(UsbEndpointIn *ep, void *arg, int status);
+
+/**
+ * Queues data to be sent on the given endpoint, and returns immediately.
+ *
+ * Writes on the same endpoint complete in order, while each endpoint progresses independently
+ * of the others. A zero length packet is sent after data that fills its last packet exactly,
+ * unless the endpoint is flagged with USB_EP_FLAG_NO_AUTO_ZLP. UsbEndpointIn::write() shares
+ * the same queue.
+ *
+ * @param ep the (non-control) endpoint to write to.
+ * @param src the data, which must remain valid until the callback runs. Word aligned data in
+ *            RAM is sent in place; anything else is copied a packet at a time through the
+ *            endpoint's own buffer.
+ * @param len the number of bytes to send.
+ * @param cb the function to call on completion, or NULL.
+ * @param arg passed through to the callback.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER, or DEVICE_NO_RESOURCES if
+ *         USB_ASYNC_WRITES_PER_EP writes are already pending on the endpoint.
+ */
+int usb_write_async(UsbEndpointIn *ep, const void *src, int len, UsbWriteCallback cb, void *arg);
+
+#if CONFIG_ENABLED(DEVICE_USB_STATS)
+
+/**
+ * Transfer counters for one endpoint.
+ *
+ * The hardware flags NAKs but doesn't count them, so the NAK counters are the number of
+ * transfers for which the host had been turned away at least once before we were ready.
+ */
+struct UsbEndpointStats
+{
+    uint32_t inPackets;
+    uint32_t inBytes;
+    uint32_t inNaks;
+    uint32_t outPackets;
+    uint32_t outBytes;
+    uint32_t outNaks;
+    uint32_t stalls;
+    uint32_t spinTime; // microseconds spent polling for writes to complete
+};
+
+/**
+ * Counters for the USB interrupt as a whole.
+ */
+struct UsbStats
+{
+    uint32_t interrupts;
+    uint32_t interruptTime;    // total microseconds spent in the USB interrupt
+    uint32_t maxInterruptTime; // longest single run of the USB interrupt, in microseconds
+};
+
+/**
+ * Returns the counters of the given endpoint, or NULL if there is no such endpoint.
+ */
+const UsbEndpointStats *usb_endpoint_stats(uint8_t ep);
+
+/**
+ * Returns the USB interrupt counters.
+ */
+const UsbStats *usb_stats();
+
+/**
+ * Zeroes all the counters.
+ */
+void usb_stats_reset();
+
+/**
+ * Writes all non-zero counters to DMESG.
+ */
+void usb_stats_dump();
+
+#endif
+
+#endif
+
+#endif
@@ -0,0 +1,113 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef CODAL_Z_PWM_GROUP_H
+#define CODAL_Z_PWM_GROUP_H
+
+#include "CodalConfig.h"
+#include "ZPin.h"
+
+// The most pins in a group: every output of the largest TCC.
+#define ZPWM_GROUP_MAX_PINS 8
+
+namespace codal
+{
+
+/**
+ * A set of PWM outputs driven by one TCC, whose duty cycles are changed together: new values
+ * are held back until all have been written, and take effect at the start of the same period.
+ * This suits motor drivers and RGB LEDs, which would otherwise see a mix of old and new values.
+ *
+ * When the group has both outputs of one of the TCC's dead-time generators, WO[x] and
+ * WO[x + 4] (TCC0 on the SAMD21, TCC0 and TCC1 on the SAMD51), the second pin is driven as the
+ * complement of the first, as for the two sides of a half bridge, and setDeadTime() keeps both
+ * low around each change.
+ */
+class ZPWMGroup
+{
+    Tcc*            tcc;
+    int             tccIndex;
+    uint8_t         divisor;                                // the TCC's prescaler setting.
+    uint32_t        top;
+    int             count;
+    ZPin*           pins[ZPWM_GROUP_MAX_PINS];
+    uint8_t         channels[ZPWM_GROUP_MAX_PINS];          // the compare channel of each pin.
+    uint8_t         complements;                            // pins that are the complement of another.
+    uint8_t         generators;                             // the dead-time generators in use.
+
+    void lock();
+    void unlock();
+    void setCompare(int channel, uint32_t value);
+
+public:
+
+    /**
+     * Constructor. Takes over a TCC that every pin of the group can be driven by, and starts
+     * it with all outputs low (complements high).
+     *
+     * @param pins the pins of the group. The array isn't kept, but the pins are used again
+     *        by the destructor.
+     * @param count the number of pins, up to ZPWM_GROUP_MAX_PINS.
+     * @param period the PWM period in microseconds, up to one second.
+     */
+    ZPWMGroup(ZPin **pins, int count, int period = DEVICE_DEFAULT_PWM_PERIOD);
+
+    /**
+     * @return the duty cycle value that keeps an output high for the whole period.
+     */
+    uint32_t getTop();
+
+    /**
+     * Sets the duty cycle of every pin of the group, all taking effect from the next period.
+     *
+     * @param values one per pin, in the order given to the constructor, from 0 (always low) to
+     *        getTop() (always high). The values of complementary pins are ignored.
+     *
+     * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER if a value is above getTop().
+     */
+    int write(const uint32_t *values);
+
+    /**
+     * Sets the time both outputs of each complementary pair are held low after either turns off.
+     *
+     * @param low the delay before the complement turns on, in the units of the duty cycle.
+     * @param high the delay before the main output turns on, in the units of the duty cycle.
+     *
+     * @return DEVICE_OK, DEVICE_INVALID_PARAMETER if a delay is negative or longer than 255
+     *         cycles of the CPU clock (the hardware's limit), or DEVICE_NOT_SUPPORTED if the
+     *         group has no complementary pairs.
+     */
+    int setDeadTime(int low, int high);
+
+    /**
+     * Destructor. Resets the TCC, making it available to other PWM outputs, and leaves the
+     * pins as digital inputs.
+     */
+    ~ZPWMGroup();
+};
+
+} // namespace codal
+
+#endif
@@ -36,6 +36,37 @@ DEALINGS IN THE SOFTWARE.
 #define DEVICE_DEFAULT_PWM_PERIOD 20000
 #endif
 
+// Events raised by setAnalogThresholds().
+#ifndef DEVICE_PIN_EVT_ANALOG_ABOVE
+#define DEVICE_PIN_EVT_ANALOG_ABOVE 8
+#endif
+
+#ifndef DEVICE_PIN_EVT_ANALOG_BELOW
+#define DEVICE_PIN_EVT_ANALOG_BELOW 9
+#endif
+
+// Event raised by playPWMSequence().
+#ifndef DEVICE_PIN_EVT_PWM_SEQUENCE_END
+#define DEVICE_PIN_EVT_PWM_SEQUENCE_END 10
+#endif
+
+// When non-zero, edges are timestamped into a queue of this many records (a power of two) by
+// the EIC interrupt, and turned into events and gpio_irq() calls by a fiber. Otherwise every
+// edge is handled in the interrupt.
+#ifndef ZPIN_EDGE_QUEUE_SIZE
+#define ZPIN_EDGE_QUEUE_SIZE 0
+#endif
+
+// The PORT registers as seen by the fast paths: through the single-cycle IOBUS where the core
+// has one (SAMD21), and through APB otherwise.
+#ifdef PORT_IOBUS
+#define ZPIN_PORT PORT_IOBUS
+#else
+#define ZPIN_PORT PORT
+#endif
+
+struct SAMDADCConfig;
+
 /**
  * Class definition for Pin.
  *
@@ -45,6 +76,7 @@ namespace codal
 {
 
 struct ZEventConfig;
+class DmaInstance;
 
 class ZPin : public Pin, public EICInterface
 {
@@ -56,7 +88,12 @@ protected:
     };
 
     EICChannel* chan;
+    SAMDADCConfig *adcCfg;
+    PortGroup *portGroup;
+    uint32_t portMask;
+    DmaInstance *pwmDma;
     int setPWM(uint32_t value, uint32_t period);
+    int preparePWMSequence(volatile uint16_t *&reg);
 
     /**
      * This member function manages the calculation of the timestamp of a pulse detected
@@ -66,6 +103,19 @@ protected:
      */
     virtual void pulseWidthEvent(int eventValue);
 
+    /**
+     * As pulseWidthEvent(int), for an edge seen at the given time.
+     */
+    void pulseWidthEvent(int eventValue, CODAL_TIMESTAMP timestamp);
+
+    /**
+     * Raises the events, or calls gpio_irq(), for an edge in whichever event mode the pin is in.
+     *
+     * @param isRise the level of the pin just after the edge.
+     * @param timestamp when the edge was seen, in microseconds.
+     */
+    void edgeEvent(bool isRise, CODAL_TIMESTAMP timestamp);
+
     /**
      * This member function will construct an TimedInterruptIn instance, and configure
      * interrupts for rise and fall.
@@ -153,6 +203,44 @@ public:
      */
     virtual int getDigitalValue(PullMode pull);
 
+    /**
+     * Drives this pin high with a single store to the port, without the checks made by
+     * setDigitalValue(). The pin has to be a digital output already, i.e. setDigitalValue()
+     * has been called since the last change of mode.
+     */
+    inline void fastSet()
+    {
+        portGroup->OUTSET.reg = portMask;
+    }
+
+    /**
+     * Drives this pin low, as fastSet().
+     */
+    inline void fastClear()
+    {
+        portGroup->OUTCLR.reg = portMask;
+    }
+
+    /**
+     * Inverts the level this pin is driven to, as fastSet().
+     */
+    inline void fastToggle()
+    {
+        portGroup->OUTTGL.reg = portMask;
+    }
+
+    /**
+     * Samples this pin with a single load from the port, without the checks made by
+     * getDigitalValue(). The pin has to be a digital input already, i.e. getDigitalValue()
+     * has been called since the last change of mode.
+     *
+     * @return 1 if this input is high, 0 if input is LO.
+     */
+    inline int fastRead()
+    {
+        return (portGroup->IN.reg & portMask) ? 1 : 0;
+    }
+
     /**
      * Configures this IO pin as an analog/pwm output, and change the output value to the given
      * level.
@@ -164,6 +252,50 @@ public:
      */
     virtual int setAnalogValue(int value);
 
+    /**
+     * Configures this IO pin as an analog/pwm output (if necessary), and plays a sequence of duty
+     * cycles on it, one per PWM period. The values are written to the timer by DMA as each period
+     * starts, so the output changes cleanly and no CPU time is needed. The period is kept from
+     * setAnalogPeriodUs(), or is DEVICE_DEFAULT_PWM_PERIOD.
+     *
+     * DEVICE_PIN_EVT_PWM_SEQUENCE_END is raised when the sequence finishes, or each time it starts
+     * over when looping. The last value stays on the output afterwards. Any other analog/pwm write
+     * stops the sequence.
+     *
+     * @param values the duty cycles, from 0 (always low) to getPWMSequenceTop() (always high).
+     *        They are read as the sequence plays, so have to be left alone until it ends.
+     * @param length the number of values.
+     * @param loop true to play the sequence over and over until stopPWMSequence() is called.
+     *
+     * @return DEVICE_OK, DEVICE_INVALID_PARAMETER if there are no values, DEVICE_NO_RESOURCES if
+     *         there's no DMA channel to use, or DEVICE_NOT_SUPPORTED if the given pin does not have
+     *         analog capability.
+     *
+     * @code
+     * uint16_t fade[64];
+     * int top = P0.getPWMSequenceTop();
+     * for (int i = 0; i < 64; i++)
+     *     fade[i] = top * i / 63;
+     * P0.playPWMSequence(fade, 64, true);
+     * @endcode
+     */
+    int playPWMSequence(const uint16_t *values, int length, bool loop = false);
+
+    /**
+     * Stops the sequence started by playPWMSequence(), leaving the current duty cycle on the output.
+     *
+     * @return DEVICE_OK, or DEVICE_INVALID_STATE if no sequence was started.
+     */
+    int stopPWMSequence();
+
+    /**
+     * Configures this IO pin as an analog/pwm output (if necessary), driven low, and provides the
+     * value of a full duty cycle for playPWMSequence() at the current period.
+     *
+     * @return the value, or DEVICE_NOT_SUPPORTED if the given pin does not have analog capability.
+     */
+    int getPWMSequenceTop();
+
     /**
      * Configures this IO pin as an analog/pwm output (if necessary) and configures the period to be
      * 20ms, with a duty cycle between 500 us and 2500 us.
@@ -201,6 +333,51 @@ public:
      */
     virtual int getAnalogValue();
 
+    /**
+     * Sets how this pin is sampled by getAnalogValue() and getAnalogSample(): resolution,
+     * averaging in hardware, sampling time, and reference and gain. The settings are kept
+     * when the pin changes mode.
+     *
+     * @param config the settings to use.
+     *
+     * @return DEVICE_OK, DEVICE_INVALID_PARAMETER if the settings aren't valid,
+     *         DEVICE_NO_RESOURCES if ZPIN_ANALOG_CONFIG_COUNT pins already have settings, or
+     *         DEVICE_NOT_SUPPORTED if the given pin does not have analog capability.
+     */
+    int setAnalogConfig(const SAMDADCConfig &config);
+
+    /**
+     * Configures this IO pin as an analogue input (if necessary), and samples the Pin at the
+     * resolution given to setAnalogConfig().
+     *
+     * @return the current analogue level on the pin, in the range 0 - (2^resolution - 1),
+     *         DEVICE_BUSY if the ADC is streaming, or DEVICE_NOT_SUPPORTED if the given pin
+     *         does not have analog capability.
+     */
+    int getAnalogSample();
+
+    /**
+     * Configures this IO pin as an analogue input watched in the background by the ADC's
+     * window monitor, which raises DEVICE_PIN_EVT_ANALOG_ABOVE when the level rises above high,
+     * and DEVICE_PIN_EVT_ANALOG_BELOW when it falls below low. Each event has to be followed by
+     * the other before it repeats, so the gap between the thresholds acts as hysteresis.
+     * Only one pin per ADC can be watched at a time; changing the pin's mode stops it.
+     *
+     * @param low the lower threshold, in the units of getAnalogSample().
+     * @param high the upper threshold, no less than low.
+     *
+     * @return DEVICE_OK, DEVICE_INVALID_PARAMETER if the thresholds are out of order,
+     *         DEVICE_BUSY if the ADC is streaming or watching another pin, or
+     *         DEVICE_NOT_SUPPORTED if the given pin does not have analog capability.
+     *
+     * @code
+     * ZPin P0(DEVICE_ID_IO_P0, DEVICE_PIN_P0, PIN_CAPABILITY_BOTH);
+     * P0.setAnalogThresholds(400, 600);
+     * bus.listen(DEVICE_ID_IO_P0, DEVICE_PIN_EVT_ANALOG_ABOVE, onHigh);
+     * @endcode
+     */
+    int setAnalogThresholds(int low, int high);
+
     /**
      * Determines if this IO pin is currently configured as an input.
      *
@@ -350,6 +527,39 @@ public:
 
     virtual void pinEventDetected();
 
+    /**
+     * Sets the hardware filtering of edges on this pin, while it's generating events. Changing
+     * mode turns the filter off again.
+     *
+     * @param filter EICFilterNone, EICFilterMajority to reject glitches of under a few EIC
+     *        clocks, or EICFilterDebounce (SAMD51 only) for mechanical switches.
+     *
+     * @return DEVICE_OK, DEVICE_INVALID_PARAMETER if the pin isn't generating events, or
+     *         DEVICE_NOT_SUPPORTED if the part has no such filter.
+     */
+    int setEventFilter(EICFilter filter);
+
+    /**
+     * Handles an edge on this pin while it's in one of the event modes, raising the events
+     * that mode asks for. Called from the EIC interrupt.
+     *
+     * With ZPIN_EDGE_QUEUE_SIZE set, the edge is only queued here, and the events are raised
+     * (and gpio_irq() called) from a fiber shortly after, in the order the edges were seen.
+     *
+     * @param isRise the level of the pin just after the edge.
+     */
+    void edgeDetected(bool isRise);
+
+    /**
+     * Handles every edge queued by edgeDetected() so far. Run by the edge queue's fiber.
+     */
+    static void processEdgeQueue();
+
+    /**
+     * Returns the number of edges dropped because the edge queue was full, since startup.
+     */
+    static uint32_t getEdgeQueueOverflows();
+
     void _setMux(int mux, bool isInput = false);
 };
 } // namespace codal
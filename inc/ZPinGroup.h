@@ -0,0 +1,137 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CODAL_Z_PIN_GROUP_H
+#define CODAL_Z_PIN_GROUP_H
+
+#include "CodalConfig.h"
+#include "ZPin.h"
+#include "SAMDDMAC.h"
+
+// The most pins in a group.
+#define ZPIN_GROUP_MAX_PINS 32
+
+// The timer that paces writeBuffer(); clear of SAMDDAC's TC3 and SAMDADC_TC.
+#ifndef ZPIN_GROUP_TC
+#ifdef SAMD21
+#define ZPIN_GROUP_TC TC4
+#else
+#define ZPIN_GROUP_TC TC1
+#endif
+#endif
+
+namespace codal
+{
+
+/**
+ * A set of pins on one port, written and read together as the bits of a value, as for a
+ * parallel bus. Every write or read is a single access to the port, so all the pins change
+ * at the same instant.
+ *
+ * Bit n of each value is pins[n] as given to the constructor. When the pins are consecutive
+ * bits of the port in the same order, values are simply shifted into place; otherwise each
+ * bit is moved individually.
+ */
+class ZPinGroup
+{
+    PortGroup*      group;
+    uint32_t        mask;                                   // the group's bits in the port.
+    int             shift;                                  // where bit 0 lands, or -1 if the pins aren't consecutive.
+    int             count;
+    uint8_t         bits[ZPIN_GROUP_MAX_PINS];              // the port bit of each pin.
+    ZPin**          pins;
+
+    DmaInstance*    dma;
+    volatile int    writeStatus;                            // the outcome of writeBuffer(), set by the DMA interrupt.
+
+    uint32_t toPort(uint32_t value);
+    uint32_t fromPort(uint32_t port);
+
+public:
+
+    /**
+     * Constructor.
+     *
+     * @param pins the pins of the group, all on the same port, in bit order. The array is
+     *        kept, so has to outlive the group.
+     * @param count the number of pins, up to ZPIN_GROUP_MAX_PINS.
+     */
+    ZPinGroup(ZPin **pins, int count);
+
+    /**
+     * Makes every pin of the group a digital output, driven low.
+     */
+    void setOutput();
+
+    /**
+     * Makes every pin of the group a digital input, with its current pull configuration.
+     */
+    void setInput();
+
+    /**
+     * Drives the pins of the group to the given value in a single write, leaving other pins
+     * of the port alone.
+     */
+    void write(uint32_t value);
+
+    /**
+     * Drives the pins given by 1 bits of the value high.
+     */
+    void set(uint32_t value);
+
+    /**
+     * Drives the pins given by 1 bits of the value low.
+     */
+    void clear(uint32_t value);
+
+    /**
+     * Samples all the pins of the group at once.
+     */
+    uint32_t read();
+
+    /**
+     * Writes a sequence of bytes to the group at a fixed rate using DMA, returning once all
+     * have been written. The calling fiber sleeps meanwhile.
+     *
+     * The group has to be consecutive pins starting at the bottom of one byte of the port
+     * (e.g. PA08 upwards), as the values are written to that byte of the port directly: any
+     * other pins in the same byte are written too.
+     *
+     * @param data the values to write, which must not be on the stack.
+     * @param len the number of values.
+     * @param frequency the number of values written per second, up to 4000000.
+     *
+     * @return DEVICE_OK, DEVICE_NOT_SUPPORTED if the group doesn't fit in one byte of the
+     *         port, DEVICE_INVALID_PARAMETER if the length isn't positive or the frequency is
+     *         out of range, or
+     *         DEVICE_NO_RESOURCES if there's no DMA channel to use.
+     */
+    int writeBuffer(const uint8_t *data, int len, int frequency);
+
+    ~ZPinGroup();
+};
+
+} // namespace codal
+
+#endif
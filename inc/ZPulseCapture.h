@@ -0,0 +1,109 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef CODAL_Z_PULSE_CAPTURE_H
+#define CODAL_Z_PULSE_CAPTURE_H
+
+#include "CodalConfig.h"
+#include "ZPin.h"
+#include "SAMDEVSYS.h"
+
+// The timer that captures pulses, unless another is given to the constructor; clear of
+// SAMDDAC's TC3 and SAMDADC_TC, and of ZPIN_GROUP_TC where the part has timers to spare.
+#ifndef ZPULSE_CAPTURE_TC
+#ifdef SAMD21
+#ifdef TC6
+#define ZPULSE_CAPTURE_TC TC6
+#else
+#define ZPULSE_CAPTURE_TC TC4
+#endif
+#else
+#ifdef TC4
+#define ZPULSE_CAPTURE_TC TC4
+#else
+#define ZPULSE_CAPTURE_TC TC0
+#endif
+#endif
+#endif
+
+namespace codal
+{
+
+/**
+ * The part of a signal that ZPulseCapture times as the pulse.
+ */
+enum ZPulseCaptureLevel
+{
+    PulseCaptureHigh = 0,
+    PulseCaptureLow
+};
+
+/**
+ * Measures the period and pulse width of the signal on a pin in hardware. The pin's external
+ * interrupt line is routed through the event system to a TC in pulse-width capture mode, which
+ * latches both times at the edges themselves. No interrupt is taken per edge, and the
+ * measurements have no software latency or jitter.
+ *
+ * Times are counted at 1MHz in 16 bits, so pulses and periods from 1us to 65ms are measured.
+ */
+class ZPulseCapture
+{
+    ZPin&           pin;
+    Tc*             tc;
+    int             extint;
+    EvsysChannel*   evsys;
+
+public:
+
+    /**
+     * Constructor. Takes over the pin's external interrupt line and the given timer, and
+     * starts measuring straight away.
+     *
+     * @param pin the pin to watch, which has to have an external interrupt line.
+     * @param level whether the pulses to time are high or low.
+     * @param tc the timer to use.
+     */
+    ZPulseCapture(ZPin &pin, ZPulseCaptureLevel level = PulseCaptureHigh, Tc *tc = ZPULSE_CAPTURE_TC);
+
+    /**
+     * Provides the most recent measurements.
+     *
+     * @param period set to the time between the last two starts of a pulse, in microseconds.
+     * @param width set to the length of the last pulse, in microseconds.
+     *
+     * @return DEVICE_OK if a pulse has ended since the last call, or DEVICE_BUSY if not, in
+     *         which case the values are the same as before.
+     */
+    int read(uint32_t &period, uint32_t &width);
+
+    /**
+     * Destructor. Stops the timer and frees the pin's external interrupt line.
+     */
+    ~ZPulseCapture();
+};
+
+} // namespace codal
+
+#endif
@@ -0,0 +1,98 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef CODAL_Z_PULSE_COUNTER_H
+#define CODAL_Z_PULSE_COUNTER_H
+
+#include "CodalConfig.h"
+#include "ZPin.h"
+#include "SAMDEVSYS.h"
+
+// The timer that counts, unless another is given to the constructor; clear of SAMDDAC's TC3
+// and SAMDADC_TC, and of the other timer defaults where the part has timers to spare.
+#ifndef ZPULSE_COUNTER_TC
+#ifdef SAMD21
+#ifdef TC7
+#define ZPULSE_COUNTER_TC TC7
+#else
+#define ZPULSE_COUNTER_TC TC4
+#endif
+#else
+#ifdef TC5
+#define ZPULSE_COUNTER_TC TC5
+#else
+#define ZPULSE_COUNTER_TC TC0
+#endif
+#endif
+#endif
+
+namespace codal
+{
+
+/**
+ * Counts the edges of the signal on a pin in hardware. The pin's external interrupt line is
+ * routed through the event system, which picks out the edges, to a TC in count mode. No
+ * interrupt is taken per edge, so signals far faster than pin events can follow are counted,
+ * and the count can be read at any time.
+ *
+ * The count is 16 bits, wrapping to zero after 65535.
+ */
+class ZPulseCounter
+{
+    Tc*             tc;
+    int             extint;
+    EvsysChannel*   evsys;
+
+public:
+
+    /**
+     * Constructor. Takes over the pin's external interrupt line and the given timer, and
+     * starts counting from zero straight away.
+     *
+     * @param pin the pin to watch, which has to have an external interrupt line.
+     * @param edge the edges to count: EvsysEdgeRise, EvsysEdgeFall or EvsysEdgeBoth.
+     * @param tc the timer to use.
+     */
+    ZPulseCounter(ZPin &pin, EvsysEdge edge = EvsysEdgeRise, Tc *tc = ZPULSE_COUNTER_TC);
+
+    /**
+     * @return the number of edges counted.
+     */
+    uint32_t read();
+
+    /**
+     * Sets the count back to zero.
+     */
+    void reset();
+
+    /**
+     * Destructor. Stops the timer and frees the pin's external interrupt line.
+     */
+    ~ZPulseCounter();
+};
+
+} // namespace codal
+
+#endif
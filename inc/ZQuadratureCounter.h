@@ -0,0 +1,97 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef CODAL_Z_QUADRATURE_COUNTER_H
+#define CODAL_Z_QUADRATURE_COUNTER_H
+
+#include "CodalConfig.h"
+#include "ZPin.h"
+#include "SAMDEVSYS.h"
+
+// The TCC that counts on the SAMD21 (the SAMD51 has a dedicated decoder, PDEC).
+#ifndef ZQUADRATURE_COUNTER_TCC
+#define ZQUADRATURE_COUNTER_TCC 1
+#endif
+
+namespace codal
+{
+
+/**
+ * Tracks the position of a quadrature encoder in hardware. The external interrupt lines of
+ * the encoder's two pins are routed through the event system to a decoder, so no interrupt
+ * is taken per edge and the position can be read at any time.
+ *
+ * On the SAMD51 the position decoder (PDEC) counts every edge of both signals (X4), in 16
+ * bits.
+ *
+ * The SAMD21 has no decoder, and this is not a true quadrature decoder there: a TCC counts
+ * the rising edges of A, up or down depending on the level of B at the time, in 24 bits. That
+ * is a direction-qualified pulse counter. It gives one count per cycle of a clean encoder
+ * signal, but it never counts the falling edges of A back out. If A chatters while B holds
+ * steady, e.g. an encoder resting on an edge of A or vibrating, every bounce counts the same
+ * way and the position drifts.
+ */
+class ZQuadratureCounter
+{
+    int             extintA;
+    int             extintB;
+    EvsysChannel*   evsysA;
+    EvsysChannel*   evsysB;
+
+#ifdef SAMD21
+    Tcc*            tcc;
+#endif
+
+public:
+
+    /**
+     * Constructor. Takes over the pins' external interrupt lines and the decoder, and starts
+     * counting from zero straight away.
+     *
+     * @param a the encoder's A signal, which has to have an external interrupt line.
+     * @param b the encoder's B signal, likewise.
+     */
+    ZQuadratureCounter(ZPin &a, ZPin &b);
+
+    /**
+     * @return the position, increasing in one direction of rotation and decreasing in the
+     *         other. It wraps around at the limits of the counter.
+     */
+    int32_t read();
+
+    /**
+     * Sets the position back to zero.
+     */
+    void reset();
+
+    /**
+     * Destructor. Stops the decoder and frees the pins' external interrupt lines.
+     */
+    ~ZQuadratureCounter();
+};
+
+} // namespace codal
+
+#endif
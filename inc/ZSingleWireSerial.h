@@ -16,6 +16,12 @@ extern "C"
 #include "sercom.h"
 }
 
+// The number of bit periods (at the current baud rate) that the line is held low for when
+// generating a break. Receivers treat anything longer than a single frame (10 bits) as a break.
+#ifndef SWS_BREAK_BIT_TIMES
+#define SWS_BREAK_BIT_TIMES     11
+#endif
+
 namespace codal
 {
     class ZSingleWireSerial : public DMASingleWireSerial, public DmaComponent
@@ -28,6 +34,9 @@ namespace codal
         uint8_t instance_number;
         uint8_t pad;
 
+        uint8_t* rxBuf;
+        int rxBreakBytes;
+
         protected:
         virtual void configureRxInterrupt(int enable);
 
@@ -71,8 +80,22 @@ namespace codal
 
         virtual int setMode(SingleWireMode sw);
 
+        /**
+         * Generates a break on the line, by holding it low for SWS_BREAK_BIT_TIMES bit periods.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the transmitter is not configured.
+         **/
         virtual int sendBreak();
 
+        /**
+         * Called from the sercom interrupt when a framing error is seen. If the line is still held
+         * low this is treated as a break, otherwise it is reported as an error.
+         *
+         * Terminates any pending receiveDMA, the number of bytes received before the break
+         * is reported by getBytesReceived().
+         **/
+        void breakDetected();
+
         void dmaTransferComplete(DmaCode c) override;
     };
 }
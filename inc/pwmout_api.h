@@ -21,6 +21,30 @@ int pwmout_init(pwmout_t *obj, uint32_t pin, uint32_t pulse, uint32_t period);
 void pwmout_free(pwmout_t *obj);
 int pwmout_write(pwmout_t *obj, uint32_t pulse, uint32_t period);
 
+/**
+ * Prepares a PWM output to have its duty cycle written directly, e.g. by DMA on each overflow
+ * of its timer. The timer's top is brought down to 16 bits if needed, and the duty cycle zeroed.
+ *
+ * @param reg set to the buffered compare register of the output, written in 16 bit halves.
+ *
+ * @return the compare value for a full duty cycle, or negative on error.
+ */
+int pwmout_compare_register(pwmout_t *obj, volatile uint16_t **reg);
+
+/**
+ * Reserves a whole TCC for use outside of pwmout, so no PWM output is given any of its channels.
+ *
+ * @param index the TCC's position in tcc_insts[].
+ *
+ * @return 0, or -1 if the TCC is already in use.
+ */
+int pwmout_claim_tcc(uint8_t index);
+
+/**
+ * Resets a TCC reserved by pwmout_claim_tcc(), and makes it available to PWM outputs again.
+ */
+void pwmout_release_tcc(uint8_t index);
+
 #ifdef __cplusplus
 }
 #endif
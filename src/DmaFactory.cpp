@@ -38,56 +38,73 @@ using namespace codal;
 DmaControllerInstance* DmaFactory::instance = NULL;
 DmaInstance* DmaFactory::apps[DMA_DESCRIPTOR_COUNT];
 
-#ifdef SAMD21
-extern "C" void DMAC_Handler(void)
-{
-    uint32_t oldChannel = DMAC->CHID.bit.ID;
-
-    int channel = DMAC->INTPEND.bit.ID;
-    DMAC->CHID.bit.ID = channel;
+DmaHandler DmaFactory::handlers[DMA_DESCRIPTOR_COUNT];
+void* DmaFactory::handlerArgs[DMA_DESCRIPTOR_COUNT];
 
-#ifdef SAMD51
-    bool err = (DMAC->CHINTFLAG.bit.ERROR > 0) ? true : false;
-#elif SAMD21
-    bool err = (DMAC->CHINTFLAG.bit.TERR > 0) ? true : false;
-#else
-    #error CHINTFLAG check needs to be implemented
+/**
+ * Services every channel with a pending interrupt, so channels completing together
+ * cost a single exception entry.
+ */
+static void dmac_irq_handler()
+{
+#ifdef SAMD21
+    uint8_t oldChannel = DMAC->CHID.reg;
 #endif
-    DMAC->CHINTFLAG.reg= DMAC_CHINTENCLR_TCMPL;
 
-    if (DmaFactory::apps[channel] != NULL && DmaFactory::apps[channel]->cb)
+    uint32_t pending;
+
+    while ((pending = DMAC->INTSTATUS.reg) != 0)
     {
-        if (err)
-            DmaFactory::apps[channel]->trigger(DMA_ERROR);
-        else
-            DmaFactory::apps[channel]->trigger(DMA_COMPLETE);
-    }
+        while (pending)
+        {
+            int channel = __builtin_ctz(pending);
+            pending &= pending - 1;
 
-    DMAC->CHID.bit.ID = oldChannel;
-}
+#ifdef SAMD21
+            DMAC->CHID.reg = channel;
+            uint8_t flags = DMAC->CHINTFLAG.reg;
+            DMAC->CHINTFLAG.reg = flags;
+            bool err = (flags & DMAC_CHINTFLAG_TERR) != 0;
+
+            // a channel that hit an error is not disabled by the hardware.
+            if (err)
+            {
+                DMAC->CHCTRLA.bit.ENABLE = 0;
+                while (DMAC->CHCTRLA.bit.ENABLE);
+            }
 #else
-static void dmac_irq_handler()
-{
-    uint8_t channel = hri_dmac_get_INTPEND_reg(DMAC, DMAC_INTPEND_ID_Msk);
+            DmacChannel *ch = &DMAC->Channel[channel];
+            uint8_t flags = ch->CHINTFLAG.reg;
+            ch->CHINTFLAG.reg = flags;
+            bool err = (flags & DMAC_CHINTFLAG_TERR) != 0;
+
+            // a channel that hit an error is not disabled by the hardware.
+            if (err)
+            {
+                ch->CHCTRLA.bit.ENABLE = 0;
+                while (ch->CHCTRLA.bit.ENABLE);
+            }
+#endif
 
-    if (hri_dmac_get_CHINTFLAG_TERR_bit(DMAC, channel))
-    {
-        hri_dmac_clear_CHINTFLAG_TERR_bit(DMAC, channel);
-        if (DmaFactory::apps[channel] != NULL && DmaFactory::apps[channel]->cb)
-            DmaFactory::apps[channel]->trigger(DMA_ERROR);
-        // tmp_resource->dma_cb.error(tmp_resource);
-    }
-    else if (hri_dmac_get_CHINTFLAG_TCMPL_bit(DMAC, channel))
-    {
-        hri_dmac_clear_CHINTFLAG_TCMPL_bit(DMAC, channel);
+            if (channel < DMA_DESCRIPTOR_COUNT && !err && DmaFactory::apps[channel])
+                DmaFactory::apps[channel]->blockCompleted();
 
-        if (DmaFactory::apps[channel] != NULL && DmaFactory::apps[channel]->cb)
-            DmaFactory::apps[channel]->trigger(DMA_COMPLETE);
+            if (channel < DMA_DESCRIPTOR_COUNT && DmaFactory::handlers[channel])
+                DmaFactory::handlers[channel](DmaFactory::handlerArgs[channel], err ? DMA_ERROR : DMA_COMPLETE);
+        }
     }
 
-    hri_dmac_clear_CHINTFLAG_reg(DMAC, channel, 0);
+#ifdef SAMD21
+    DMAC->CHID.reg = oldChannel;
+#endif
 }
 
+#ifdef SAMD21
+extern "C" void DMAC_Handler(void)
+{
+    dmac_irq_handler();
+}
+#else
 extern "C" void DMAC_0_Handler(void)
 {
     dmac_irq_handler();
@@ -196,6 +213,7 @@ void DmaFactory::instantiate()
         return;
 
     memclr(apps, sizeof(DmaInstance*) * DMA_DESCRIPTOR_COUNT);
+    memclr(handlers, sizeof(DmaHandler) * DMA_DESCRIPTOR_COUNT);
     instance = new DmaControllerInstance();
 }
 
@@ -223,10 +241,11 @@ DmacDescriptor &DmaFactory::getDescriptor(int channel)
 
 /**
  * Allocates an unused DMA channel, if one is available.
- * @return a valid channel descriptor in the range 1..DMA_DESCRIPTOR_COUNT, or DEVICE_NO_RESOURCES
- * otherwise.
+ *
+ * @param priority the arbitration priority of the channel.
+ * @return a new DmaInstance, or NULL if all DMA_DESCRIPTOR_COUNT channels are in use.
  */
-DmaInstance* DmaFactory::allocate()
+DmaInstance* DmaFactory::allocate(DmaPriority priority)
 {
     instantiate();
 
@@ -235,11 +254,12 @@ DmaInstance* DmaFactory::allocate()
         if (!instance->descriptors[i + DMA_DESCRIPTOR_COUNT].BTCTRL.bit.VALID)
         {
             instance->descriptors[i + DMA_DESCRIPTOR_COUNT].BTCTRL.bit.VALID = 1;
-            DmaFactory::apps[i] = new DmaInstance(i);
+            DmaFactory::apps[i] = new DmaInstance(i, priority);
             return DmaFactory::apps[i];
         }
     }
 
+    DMESG("DMA: no free channels");
     return NULL;
 }
 
@@ -255,6 +275,7 @@ void DmaFactory::free(DmaInstance* dmaInstance)
         if (DmaFactory::apps[i] == dmaInstance)
         {
             instance->descriptors[i + DMA_DESCRIPTOR_COUNT].BTCTRL.bit.VALID = 0;
+            DmaFactory::handlers[i] = NULL;
             DmaFactory::apps[i] = NULL;
             return;
         }
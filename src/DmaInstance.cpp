@@ -10,10 +10,72 @@
 
 using namespace codal;
 
-DmaInstance::DmaInstance(int channel)
+#ifdef SAMD21
+/**
+ * Points the channel registers at the given channel, returning the previous selection.
+ *
+ * CHID is shared with interrupt handlers, so rather than masking interrupts every access
+ * saves and restores it; an interrupted sequence then sees its own selection again on return.
+ */
+static inline uint8_t dma_select_channel(int channel)
+{
+    uint8_t previous = DMAC->CHID.reg;
+    DMAC->CHID.reg = channel;
+    return previous;
+}
+#endif
+
+// storage for every DmaInstance there can be, one per channel.
+alignas(DmaInstance) static uint8_t dmaInstancePool[DMA_DESCRIPTOR_COUNT][sizeof(DmaInstance)];
+static uint32_t dmaInstancePoolUsed;
+
+void *DmaInstance::operator new(size_t size)
+{
+    void *p = NULL;
+
+    target_disable_irq();
+    for (int i = 0; i < DMA_DESCRIPTOR_COUNT; i++)
+    {
+        if (!(dmaInstancePoolUsed & (1UL << i)))
+        {
+            dmaInstancePoolUsed |= 1UL << i;
+            p = dmaInstancePool[i];
+            break;
+        }
+    }
+    target_enable_irq();
+
+    if (p == NULL)
+        target_panic(DEVICE_HARDWARE_CONFIGURATION_ERROR);
+
+    return p;
+}
+
+void DmaInstance::operator delete(void *p)
+{
+    target_disable_irq();
+    dmaInstancePoolUsed &= ~(1UL << (((uint8_t *)p - dmaInstancePool[0]) / sizeof(DmaInstance)));
+    target_enable_irq();
+}
+
+DmaInstance::DmaInstance(int channel, DmaPriority priority)
 {
     this->channel_number = channel;
+    this->priority = priority;
     this->cb = NULL;
+    this->bufferSize = 0;
+    this->circularBuffer = NULL;
+    this->circularSize = 0;
+}
+
+void DmaInstance::setPriority(DmaPriority priority)
+{
+    this->priority = priority;
+}
+
+DmaPriority DmaInstance::getPriority()
+{
+    return priority;
 }
 
 /**
@@ -23,11 +85,16 @@ DmaInstance::DmaInstance(int channel)
 void DmaInstance::disable()
 {
 #ifdef SAMD21
-    DMAC->CHID.bit.ID = channel_number; // Select our allocated channel
+    uint8_t previous = dma_select_channel(channel_number);
     DMAC->CHCTRLA.bit.ENABLE = 0;
+    // the channel finishes its current beat before it lets go of its descriptor.
+    while (DMAC->CHCTRLA.bit.ENABLE);
+    DMAC->CHID.reg = previous;
 #else
     DmacChannel *channel = &DMAC->Channel[channel_number];
     channel->CHCTRLA.bit.ENABLE = 0;
+    // the channel finishes its current burst before it lets go of its descriptor.
+    while (channel->CHCTRLA.bit.ENABLE);
 #endif
 }
 
@@ -37,11 +104,11 @@ void DmaInstance::disable()
 void DmaInstance::enable()
 {
 #ifdef SAMD21
-    /** Select the DMA channel and clear software trigger */
-    DMAC->CHID.bit.ID = channel_number;
+    uint8_t previous = dma_select_channel(channel_number);
     // Clear any previous interrupts.
     DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_MASK;
     DMAC->CHCTRLA.bit.ENABLE = true;
+    DMAC->CHID.reg = previous;
 #else
     DmacChannel *channel = &DMAC->Channel[channel_number];
     // Clear any previous interrupts.
@@ -54,14 +121,16 @@ void DmaInstance::trigger(DmaCode c)
 {
     disable();
 
-    if (this->cb)
-        this->cb->dmaTransferComplete(c);
+    DmaHandler handler = DmaFactory::handlers[channel_number];
+    if (handler)
+        handler(DmaFactory::handlerArgs[channel_number], c);
 }
 
 
 void DmaInstance::abort()
 {
     disable();
+    circularSize = 0;
 }
 
 /**
@@ -75,6 +144,19 @@ void DmaInstance::abort()
 int DmaInstance::onTransferComplete(DmaComponent *component)
 {
     cb = component;
+    return onTransferComplete(component ? dma_member_handler<DmaComponent> : NULL, component);
+}
+
+int DmaInstance::onTransferComplete(DmaHandler handler, void *arg)
+{
+    // the handler may be looked up by the interrupt at any time, so clear it before changing arg.
+    DmaFactory::handlers[channel_number] = NULL;
+    DmaFactory::handlerArgs[channel_number] = arg;
+    DmaFactory::handlers[channel_number] = handler;
+
+    if (handler != dma_member_handler<DmaComponent>)
+        cb = NULL;
+
     return DEVICE_OK;
 }
 
@@ -93,85 +175,290 @@ void DmaInstance::setDescriptor(DmacDescriptor* desc)
     DmaFactory::instance->setDescriptor(channel_number, desc);
 }
 
-void DmaInstance::transfer(const void *src_addr, void *dst_addr, uint32_t len)
+void DmaInstance::prepareTransfer(const void *src_addr, void *dst_addr, uint32_t len)
 {
     CODAL_ASSERT(channel_number >= 0, DEVICE_HARDWARE_CONFIGURATION_ERROR);
-    target_disable_irq();
+
+    // The controller only reads the descriptor of an enabled channel, so with ours disabled
+    // it can be rewritten without holding off anyone else's interrupts.
+    disable();
+
     DmacDescriptor &descriptor = DmaFactory::instance->getDescriptor(channel_number);
 
     descriptor.BTCNT.bit.BTCNT = len >> descriptor.BTCTRL.bit.BEATSIZE;
+    descriptor.DESCADDR.reg = 0; // undo any startCircular()
+
+    // the write-back copy only gets updated once the channel has run, so start it off full.
+    DmaFactory::instance->getWriteBackDescriptor(channel_number).BTCNT.reg = descriptor.BTCNT.reg;
 
     this->bufferSize = len >> descriptor.BTCTRL.bit.BEATSIZE;
+    this->circularSize = 0;
 
+    // incrementing addresses are given to the controller as the end of the block.
     if (src_addr)
-        descriptor.SRCADDR.reg = (uint32_t)src_addr + len;
+        descriptor.SRCADDR.reg = (uint32_t)src_addr + (descriptor.BTCTRL.bit.SRCINC ? len : 0);
     if (dst_addr)
-        descriptor.DSTADDR.reg = (uint32_t)dst_addr + len;
+        descriptor.DSTADDR.reg = (uint32_t)dst_addr + (descriptor.BTCTRL.bit.DSTINC ? len : 0);
+}
 
+void DmaInstance::transfer(const void *src_addr, void *dst_addr, uint32_t len)
+{
+    prepareTransfer(src_addr, dst_addr, len);
     enable();
+}
 
-    target_enable_irq();
+void DmaInstance::configureMemory()
+{
+    configure(0, BeatByte, NULL, NULL);
+
+#ifdef SAMD21
+    uint8_t previous = dma_select_channel(channel_number);
+    DMAC->CHCTRLB.bit.TRIGACT = DMAC_CHCTRLB_TRIGACT_BLOCK_Val; // One trigger per block
+    DMAC->CHID.reg = previous;
+#else
+    DMAC->Channel[channel_number].CHCTRLA.bit.TRIGACT = DMAC_CHCTRLA_TRIGACT_BLOCK_Val; // One trigger per block
+#endif
+
+    DmacDescriptor &descriptor = DmaFactory::instance->getDescriptor(channel_number);
+
+    descriptor.BTCTRL.bit.SRCINC = 1;
+    descriptor.BTCTRL.bit.DSTINC = 1;
+    descriptor.BTCTRL.bit.EVOSEL = 0; // No events
 }
 
-int DmaInstance::getBytesTransferred()
+void DmaInstance::setEventInput(DmaEventAction action)
 {
-    uint32_t btcnt = 0;
 #ifdef SAMD21
-    uint8_t chan = DMAC->CHID.bit.ID;
-    DMAC->CHID.bit.ID = channel_number; // Select our allocated channel
-    btcnt = DMAC->ACTIVE.bit.BTCNT;
-    DMAC->CHID.bit.ID = chan; // Select our allocated channel
+    uint8_t previous = dma_select_channel(channel_number);
+    DMAC->CHCTRLB.bit.EVACT = action;
+    DMAC->CHCTRLB.bit.EVIE = action != DmaEventNone;
+    DMAC->CHID.reg = previous;
 #else
-    DMAC_ACTIVE_Type active;
-    active.reg = DMAC->ACTIVE.reg;
-    if (active.bit.ID == channel_number)
-        btcnt = active.bit.BTCNT;
-    else
+    DMAC->Channel[channel_number].CHEVCTRL.reg =
+        DMAC_CHEVCTRL_EVACT(action) | (action != DmaEventNone ? DMAC_CHEVCTRL_EVIE : 0);
+#endif
+}
+
+void DmaInstance::softwareTrigger()
+{
+    // writing zeros leaves the other channels alone.
+    DMAC->SWTRIGCTRL.reg = 1 << channel_number;
+}
+
+int DmaInstance::getBytesTransferred()
+{
+    // The remaining count of the channel the controller is servicing right now lives in ACTIVE;
+    // every other channel's was written back to its write-back descriptor when it last stopped.
+    // Read ACTIVE either side of the descriptor in case the channel started or stopped meanwhile.
+    DmacDescriptor &desc = DmaFactory::instance->getWriteBackDescriptor(channel_number);
+    uint32_t btcnt;
+
+    while (true)
     {
-        DmacDescriptor& desc = DmaFactory::instance->getWriteBackDescriptor(channel_number);
+        DMAC_ACTIVE_Type before, after;
+
+        before.reg = DMAC->ACTIVE.reg;
         btcnt = desc.BTCNT.reg;
+        after.reg = DMAC->ACTIVE.reg;
+
+        bool wasActive = before.bit.ABUSY && before.bit.ID == channel_number;
+        bool isActive = after.bit.ABUSY && after.bit.ID == channel_number;
+
+        if (isActive)
+        {
+            btcnt = after.bit.BTCNT;
+            break;
+        }
+
+        if (!wasActive)
+            break;
     }
 
+    DmacDescriptor &descriptor = DmaFactory::instance->getDescriptor(channel_number);
+    return (this->bufferSize - btcnt) << descriptor.BTCTRL.bit.BEATSIZE;
+}
+
+int DmaInstance::startCircular(void *buffer, uint32_t len, bool notify)
+{
+    DmacDescriptor &descriptor = DmaFactory::instance->getDescriptor(channel_number);
+
+    bool tx = !descriptor.BTCTRL.bit.DSTINC;
+
+    if ((tx && !descriptor.BTCTRL.bit.SRCINC) || len == 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    prepareTransfer(tx ? buffer : NULL, tx ? NULL : buffer, len);
+
+    // link the descriptor to itself, so the channel reloads it at the end of every block,
+    // and interrupt on each block so we can count the laps.
+    descriptor.DESCADDR.reg = (uint32_t)&descriptor;
+    descriptor.BTCTRL.bit.BLOCKACT = notify ? DMAC_BTCTRL_BLOCKACT_INT_Val : DMAC_BTCTRL_BLOCKACT_NOACT_Val;
+
+    circularBuffer = (uint8_t *)buffer;
+    circularWraps = 0;
+    circularRead = 0;
+    circularLast = 0;
+    circularOverruns = 0;
+    circularSize = len;
+
+    enable();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Works out how many bytes the circular transfer has written in total.
+ */
+uint32_t DmaInstance::getCircularWritten()
+{
+    uint32_t wraps, position;
+
+    do
+    {
+        wraps = circularWraps;
+        position = getBytesTransferred();
+    } while (wraps != circularWraps);
+
+    uint32_t written = wraps * circularSize + position;
+
+    // the channel may have wrapped without the interrupt having counted it yet.
+    if (written < circularLast)
+        written += circularSize;
+
+    circularLast = written;
+    return written;
+}
+
+int DmaInstance::circularPeek(uint8_t *&data)
+{
+    if (circularSize == 0)
+        return DEVICE_INVALID_STATE;
+
+    uint32_t written = getCircularWritten();
+    uint32_t available = written - circularRead;
+
+    if (available > circularSize)
+    {
+        circularOverruns++;
+        circularRead = written;
+        available = 0;
+    }
+
+    uint32_t offset = circularRead % circularSize;
+
+    if (available > circularSize - offset)
+        available = circularSize - offset;
+
+    data = circularBuffer + offset;
+    return available;
+}
+
+void DmaInstance::circularConsume(uint32_t len)
+{
+    circularRead += len;
+}
+
+uint32_t DmaInstance::getCircularOverruns()
+{
+    return circularOverruns;
+}
+
+// channel currently fed to the CRC engine, or -1 if it's free.
+static volatile int crcOwner = -1;
+static DmaCrcType crcType;
+
+int DmaInstance::enableCrc(DmaCrcType type)
+{
+    target_disable_irq();
+    bool busy = crcOwner >= 0 && crcOwner != channel_number;
+    if (!busy)
+        crcOwner = channel_number;
+    target_enable_irq();
+
+    if (busy)
+        return DEVICE_BUSY;
+
+    crcType = type;
+
+    DmacDescriptor &descriptor = getDescriptor();
+
+    // the checksum can only be seeded, and the source changed, while the engine is detached.
+#ifdef SAMD21
+    DMAC->CTRL.bit.CRCENABLE = 0;
 #endif
-    return this->bufferSize - btcnt;
+    DMAC->CRCCTRL.reg = 0;
+    DMAC->CRCCHKSUM.reg = type == DmaCrc32 ? 0xFFFFFFFF : 0xFFFF;
+    DMAC->CRCCTRL.reg = DMAC_CRCCTRL_CRCBEATSIZE(descriptor.BTCTRL.bit.BEATSIZE) |
+                        DMAC_CRCCTRL_CRCPOLY(type) |
+                        DMAC_CRCCTRL_CRCSRC(0x20 + channel_number);
+#ifdef SAMD21
+    DMAC->CTRL.bit.CRCENABLE = 1;
+#endif
+
+    return DEVICE_OK;
+}
+
+uint32_t DmaInstance::getCrc()
+{
+    if (crcOwner != channel_number)
+        return 0;
+
+    uint32_t crc = DMAC->CRCCHKSUM.reg;
+
+    return crcType == DmaCrc32 ? crc : crc & 0xFFFF;
+}
+
+void DmaInstance::disableCrc()
+{
+    if (crcOwner != channel_number)
+        return;
+
+#ifdef SAMD21
+    DMAC->CTRL.bit.CRCENABLE = 0;
+#endif
+    DMAC->CRCCTRL.reg = 0;
+
+    crcOwner = -1;
 }
 
 void DmaInstance::configure(uint8_t trig_src, DmaBeatSize beat_size, volatile void *src_addr, volatile void *dst_addr)
 {
     CODAL_ASSERT(channel_number >= 0, DEVICE_HARDWARE_CONFIGURATION_ERROR);
-    target_disable_irq();
 
+    // SWRST leaves the channel disabled, so nothing reads the descriptor until transfer().
+    // (SWTRIGCTRL needs no attention: its bits only ever clear themselves.)
 #ifdef SAMD21
-    DMAC->CHID.bit.ID = channel_number; // Select our allocated channel
+    uint8_t previous = dma_select_channel(channel_number);
 
     DMAC->CHCTRLA.bit.ENABLE = 0;
+    while (DMAC->CHCTRLA.bit.ENABLE);
     DMAC->CHCTRLA.bit.SWRST = 1;
 
     while (DMAC->CHCTRLA.bit.SWRST);
 
-    DMAC->SWTRIGCTRL.reg &= (uint32_t)(~(1 << channel_number));
-
     // DMAC->CHCTRLB.bit.CMD = 0;     // No Command (yet)
     DMAC->CHCTRLB.bit.TRIGACT = 2; // One trigger per beat transfer
     DMAC->CHCTRLB.bit.TRIGSRC = trig_src;
-    DMAC->CHCTRLB.bit.LVL = 0;   // Low priority transfer
+    DMAC->CHCTRLB.bit.LVL = priority; // Arbitration level
     DMAC->CHCTRLB.bit.EVOE = 0;  // Disable output event on every BEAT
     DMAC->CHCTRLB.bit.EVIE = 0;  // Disable input event
     DMAC->CHCTRLB.bit.EVACT = 0; // Trigger DMA transfer on BEAT
 
     DMAC->CHINTENSET.bit.TCMPL = 1; // Enable interrupt on completion.
+
+    DMAC->CHID.reg = previous;
 #else
     DmacChannel *channel = &DMAC->Channel[channel_number];
 
     channel->CHCTRLA.bit.ENABLE = 0;
+    while (channel->CHCTRLA.bit.ENABLE);
     channel->CHCTRLA.bit.SWRST = 1;
 
     while (channel->CHCTRLA.bit.SWRST);
 
-    DMAC->SWTRIGCTRL.reg &= (uint32_t)(~(1 << channel_number));
-
     channel->CHCTRLA.bit.TRIGACT = 2; // One trigger per beat transfer
     channel->CHCTRLA.bit.TRIGSRC = trig_src;
+    channel->CHPRILVL.reg = DMAC_CHPRILVL_PRILVL(priority); // Arbitration level
     /*
     channel->CHCTRLA.bit.LVL = 0;   // Low priority transfer
     channel->CHCTRLA.bit.EVOE = 0;  // Disable output event on every BEAT
@@ -203,11 +490,10 @@ void DmaInstance::configure(uint8_t trig_src, DmaBeatSize beat_size, volatile vo
     descriptor.DESCADDR.reg = 0;
 
     descriptor.BTCTRL.bit.VALID = 1; // Enable the descritor
-
-    target_enable_irq();
 }
 
 DmaInstance::~DmaInstance()
 {
+    disableCrc();
     DmaFactory::free(this);
 }
\ No newline at end of file
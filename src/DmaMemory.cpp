@@ -0,0 +1,395 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "DmaMemory.h"
+#include "CodalFiber.h"
+#include "Event.h"
+#include "codal_target_hal.h"
+#include "CodalDmesg.h"
+#include <string.h>
+
+using namespace codal;
+
+// the largest block a single descriptor can move, in beats (BTCNT is 16 bits).
+#define DMA_MEMORY_MAX_BEATS 0xFFFF
+
+enum DmaMemoryOp
+{
+    MemoryCopy,
+    MemoryFill,
+    MemoryCrc     // reads the source into memorySink, for the benefit of the CRC engine
+};
+
+// the operation currently running on our channel.
+static DmaInstance *memoryDma;
+static volatile bool memoryBusy;
+static uint8_t *memoryDst;
+static const uint8_t *memorySrc;
+static uint32_t memoryRemaining;
+static DmaMemoryOp memoryOp;
+static DmaBeatSize memoryBeat;
+static uint32_t memoryCrc; // the checksum, once a CRC operation has completed
+static DmaHandler memoryHandler;
+static void *memoryHandlerArg;
+static bool memoryBlocking; // a blocking call owns the channel, and releases it itself
+
+// the source of fills; four copies of the value so any beat size reads the same thing.
+static uint32_t memoryPattern;
+
+// the destination of CRC operations, which only need the data read.
+static uint32_t memorySink;
+
+/**
+ * Picks the widest beat that every address and the length are aligned to.
+ */
+static DmaBeatSize dma_memory_beat(uint32_t alignment)
+{
+    if ((alignment & 3) == 0)
+        return BeatWord;
+
+    if ((alignment & 1) == 0)
+        return BeatHalfWord;
+
+    return BeatByte;
+}
+
+/**
+ * Takes ownership of the channel, allocating it if need be.
+ *
+ * @return true if the channel is ours, false if the CPU should do the work instead.
+ */
+static bool dma_memory_claim()
+{
+    target_disable_irq();
+    bool busy = memoryBusy;
+    memoryBusy = true;
+    target_enable_irq();
+
+    if (busy)
+        return false;
+
+    if (memoryDma == NULL)
+    {
+        memoryDma = DmaFactory::allocate();
+
+        if (memoryDma == NULL)
+        {
+            memoryBusy = false;
+            return false;
+        }
+
+        memoryDma->configureMemory();
+    }
+
+    return true;
+}
+
+/**
+ * Hands the next block of the current operation to the channel.
+ */
+static void dma_memory_next()
+{
+    uint32_t beats = memoryRemaining >> memoryBeat;
+    if (beats > DMA_MEMORY_MAX_BEATS)
+        beats = DMA_MEMORY_MAX_BEATS;
+
+    uint32_t len = beats << memoryBeat;
+
+    DmacDescriptor &descriptor = memoryDma->getDescriptor();
+    descriptor.BTCTRL.bit.BEATSIZE = memoryBeat;
+    descriptor.BTCTRL.bit.SRCINC = memoryOp == MemoryFill ? 0 : 1;
+    descriptor.BTCTRL.bit.DSTINC = memoryOp == MemoryCrc ? 0 : 1;
+
+    memoryDma->transfer(memoryOp == MemoryFill ? (const void *)&memoryPattern : memorySrc,
+                        memoryOp == MemoryCrc ? (void *)&memorySink : memoryDst, len);
+
+    if (memoryOp != MemoryFill)
+        memorySrc += len;
+    if (memoryOp != MemoryCrc)
+        memoryDst += len;
+    memoryRemaining -= len;
+
+    memoryDma->softwareTrigger();
+}
+
+/**
+ * Called from the DMA interrupt as each block completes.
+ */
+static void dma_memory_irq(void *, DmaCode c)
+{
+    if (c == DMA_COMPLETE && memoryRemaining)
+    {
+        dma_memory_next();
+        return;
+    }
+
+    // the CRC engine carries on across blocks, so the checksum is only ready now.
+    if (memoryOp == MemoryCrc)
+    {
+        memoryCrc = memoryDma->getCrc();
+        memoryDma->disableCrc();
+    }
+
+    // release the channel first, so the handler can start another operation. A blocking
+    // call keeps it until it has collected the result.
+    DmaHandler handler = memoryHandler;
+    void *arg = memoryHandlerArg;
+    if (!memoryBlocking)
+        memoryBusy = false;
+
+    if (handler)
+        handler(arg, c);
+}
+
+/**
+ * Does an operation with the CPU.
+ */
+static void dma_memory_cpu(void *dst, const void *src, uint8_t value, uint32_t len, DmaMemoryOp op)
+{
+    if (op == MemoryFill)
+        memset(dst, value, len);
+    else
+        memcpy(dst, src, len);
+}
+
+/**
+ * Starts an operation on the channel, which the caller has claimed.
+ */
+static int dma_memory_start(void *dst, const void *src, uint8_t value, uint32_t len, DmaMemoryOp op,
+                            DmaHandler handler, void *arg)
+{
+    if (op == MemoryCrc)
+    {
+        // byte beats, so the checksum doesn't depend on the alignment of the data.
+        memoryDma->getDescriptor().BTCTRL.bit.BEATSIZE = BeatByte;
+
+        if (memoryDma->enableCrc((DmaCrcType)value) != DEVICE_OK)
+        {
+            memoryBusy = false;
+            return DEVICE_BUSY;
+        }
+
+        memoryBeat = BeatByte;
+    }
+    else
+    {
+        memoryBeat = dma_memory_beat((uint32_t)dst | (op == MemoryFill ? 0 : (uint32_t)src) | len);
+    }
+
+    memoryDst = (uint8_t *)dst;
+    memorySrc = (const uint8_t *)src;
+    memoryRemaining = len;
+    memoryOp = op;
+    memoryPattern = (uint32_t)value * 0x01010101u;
+    memoryHandler = handler;
+    memoryHandlerArg = arg;
+
+    memoryDma->onTransferComplete(dma_memory_irq, NULL);
+
+    dma_memory_next();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Runs an asynchronous copy or fill on the channel, or with the CPU if the channel isn't
+ * available.
+ */
+static int dma_memory_run(void *dst, const void *src, uint8_t value, uint32_t len, DmaMemoryOp op,
+                          DmaHandler handler, void *arg)
+{
+    if (len < DMA_MEMORY_THRESHOLD || !dma_memory_claim())
+    {
+        dma_memory_cpu(dst, src, value, len, op);
+
+        if (handler)
+            handler(arg, DMA_COMPLETE);
+
+        return DEVICE_OK;
+    }
+
+    memoryBlocking = false;
+
+    return dma_memory_start(dst, src, value, len, op, handler, arg);
+}
+
+// notify event used to wake fibers waiting in the blocking calls, allocated on first use.
+static uint16_t memoryEventCode;
+
+// outcome of the blocking call that owns the channel. Kept here rather than on the caller's
+// stack, which is swapped out while the caller sleeps.
+static volatile int memoryStatus;
+
+/**
+ * Completion handler for the blocking calls. The caller keeps the channel until it has
+ * read memoryStatus, see dma_memory_irq().
+ */
+static void dma_memory_done(void *, DmaCode c)
+{
+    // a bus error means one of the addresses was bad.
+    memoryStatus = c == DMA_COMPLETE ? DEVICE_OK : DEVICE_INVALID_PARAMETER;
+
+    if (memoryEventCode)
+        Event(DEVICE_ID_NOTIFY, memoryEventCode);
+}
+
+/**
+ * Does the work of the DMA interrupt for our channel, for callers that can't wait for it.
+ * Call with interrupts disabled.
+ */
+static void dma_memory_poll()
+{
+    uint8_t flags;
+
+#ifdef SAMD21
+    uint8_t previous = DMAC->CHID.reg;
+    DMAC->CHID.reg = memoryDma->channel_number;
+    flags = DMAC->CHINTFLAG.reg & (DMAC_CHINTFLAG_TCMPL | DMAC_CHINTFLAG_TERR);
+    DMAC->CHINTFLAG.reg = flags;
+
+    // a channel that hit an error is not disabled by the hardware.
+    if (flags & DMAC_CHINTFLAG_TERR)
+    {
+        DMAC->CHCTRLA.bit.ENABLE = 0;
+        while (DMAC->CHCTRLA.bit.ENABLE);
+    }
+    DMAC->CHID.reg = previous;
+#else
+    DmacChannel *ch = &DMAC->Channel[memoryDma->channel_number];
+    flags = ch->CHINTFLAG.reg & (DMAC_CHINTFLAG_TCMPL | DMAC_CHINTFLAG_TERR);
+    ch->CHINTFLAG.reg = flags;
+
+    if (flags & DMAC_CHINTFLAG_TERR)
+    {
+        ch->CHCTRLA.bit.ENABLE = 0;
+        while (ch->CHCTRLA.bit.ENABLE);
+    }
+#endif
+
+    if (flags)
+        dma_memory_irq(NULL, (flags & DMAC_CHINTFLAG_TERR) ? DMA_ERROR : DMA_COMPLETE);
+}
+
+/**
+ * Runs an operation to completion, sleeping the calling fiber where possible.
+ */
+static int dma_memory_wait(void *dst, const void *src, uint8_t value, uint32_t len, DmaMemoryOp op)
+{
+    // the DMA interrupt can only be waited for from thread mode with interrupts enabled. From
+    // anywhere else copies and fills are left to the CPU, and checksums poll the channel.
+    bool interrupts = __get_IPSR() == 0 && __get_PRIMASK() == 0;
+    bool sleep = interrupts && fiber_scheduler_running();
+
+    if (op == MemoryCrc)
+    {
+        if (!dma_memory_claim())
+            return DEVICE_BUSY;
+    }
+    else if (!interrupts || len < DMA_MEMORY_THRESHOLD || !dma_memory_claim())
+    {
+        dma_memory_cpu(dst, src, value, len, op);
+        return DEVICE_OK;
+    }
+
+    if (sleep && memoryEventCode == 0)
+        memoryEventCode = allocateNotifyEvent();
+
+    memoryStatus = DEVICE_BUSY;
+    memoryBlocking = true;
+
+    int result = dma_memory_start(dst, src, value, len, op, dma_memory_done, NULL);
+
+    if (result != DEVICE_OK)
+    {
+        memoryBlocking = false;
+        return result;
+    }
+
+    if (sleep)
+    {
+        target_disable_irq();
+        while (memoryStatus == DEVICE_BUSY)
+        {
+            fiber_wake_on_event(DEVICE_ID_NOTIFY, memoryEventCode);
+            target_enable_irq();
+            schedule();
+            target_disable_irq();
+        }
+        target_enable_irq();
+    }
+    else if (interrupts)
+    {
+        while (memoryStatus == DEVICE_BUSY);
+    }
+    else
+    {
+        // keep the DMA interrupt (if it could run at all) from taking the flags we poll.
+        target_disable_irq();
+        while (memoryStatus == DEVICE_BUSY)
+            dma_memory_poll();
+        target_enable_irq();
+    }
+
+    result = memoryStatus;
+
+    // dst is where a checksum goes; the caller's stack is only safe to write now it is running.
+    if (op == MemoryCrc)
+        *(uint32_t *)dst = memoryCrc;
+
+    memoryBlocking = false;
+    memoryBusy = false;
+
+    return result;
+}
+
+int DmaMemory::copy(void *dst, const void *src, uint32_t len)
+{
+    return dma_memory_wait(dst, src, 0, len, MemoryCopy);
+}
+
+int DmaMemory::fill(void *dst, uint8_t value, uint32_t len)
+{
+    return dma_memory_wait(dst, NULL, value, len, MemoryFill);
+}
+
+int DmaMemory::copyAsync(void *dst, const void *src, uint32_t len, DmaHandler handler, void *arg)
+{
+    return dma_memory_run(dst, src, 0, len, MemoryCopy, handler, arg);
+}
+
+int DmaMemory::fillAsync(void *dst, uint8_t value, uint32_t len, DmaHandler handler, void *arg)
+{
+    return dma_memory_run(dst, NULL, value, len, MemoryFill, handler, arg);
+}
+
+int DmaMemory::crc(const void *data, uint32_t len, DmaCrcType type, uint32_t &result)
+{
+    if (len == 0)
+    {
+        result = type == DmaCrc32 ? 0xFFFFFFFF : 0xFFFF;
+        return DEVICE_OK;
+    }
+
+    return dma_memory_wait(&result, data, (uint8_t)type, len, MemoryCrc);
+}
@@ -0,0 +1,716 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "Event.h"
+#include "CodalCompat.h"
+#include "CodalDmesg.h"
+#include "SAMDADC.h"
+#include "pinmap.h"
+#include "hal_adc_sync.h"
+#include "tc.h"
+#include <string.h>
+
+extern "C"
+{
+#include "adc.h"
+#include "clocks.h"
+#include "timers.h"
+}
+
+#undef ENABLE
+
+SAMDADC* SAMDADC::instances[SAMDADC_INSTANCES] = { NULL };
+
+// only used to bring each ADC up; after that the registers are driven directly.
+static adc_sync_descriptor adc_descriptors[SAMDADC_INSTANCES];
+
+static inline void adc_sync(Adc *adc)
+{
+#ifdef SAMD21
+    while (adc->STATUS.bit.SYNCBUSY);
+#else
+    while (adc->SYNCBUSY.reg);
+#endif
+}
+
+/**
+ * Runs a single conversion of the given input, with the ADC otherwise as configured.
+ */
+static int adc_convert(Adc *adc, int input)
+{
+    adc->INPUTCTRL.bit.MUXPOS = input;
+    adc_sync(adc);
+
+    adc->INTFLAG.reg = ADC_INTFLAG_RESRDY;
+#ifdef SAMD21
+    adc->SWTRIG.reg = ADC_SWTRIG_START;
+#else
+    adc->SWTRIG.bit.START = 1;
+#endif
+
+    while (!(adc->INTFLAG.reg & ADC_INTFLAG_RESRDY));
+    adc_sync(adc);
+
+    return adc->RESULT.reg;
+}
+
+static void adc_set_evctrl(Adc *adc, uint8_t evctrl)
+{
+#ifdef SAMD21
+    adc->EVCTRL.reg = evctrl;
+#else
+    // EVCTRL is enable-protected on the SAMD51.
+    adc->CTRLA.bit.ENABLE = 0;
+    adc_sync(adc);
+    adc->EVCTRL.reg = evctrl;
+    adc->CTRLA.bit.ENABLE = 1;
+    adc_sync(adc);
+#endif
+}
+
+bool SAMDADC::isValid(const SAMDADCConfig &config)
+{
+    if (config.sampleTime > 63)
+        return false;
+
+    // without averaging, the hardware resolutions only.
+    if (config.samples == 1)
+        return config.resolution == 8 || config.resolution == 10 || config.resolution == 12;
+
+    return config.resolution >= 8 && config.resolution <= 16 &&
+           config.samples > 0 && config.samples <= 1024 && (config.samples & (config.samples - 1)) == 0;
+}
+
+/**
+ * The number of significant bits in RESULT when converting with the given configuration.
+ */
+static int adc_result_bits(const SAMDADCConfig &config)
+{
+    if (config.samples == 1)
+        return config.resolution;
+
+    // the sum of 2^n 12 bit results has 12 + n bits, shifted down by the hardware to fit in 16.
+    int bits = 12 + __builtin_ctz(config.samples);
+
+    return bits < 16 ? bits : 16;
+}
+
+static inline int adc_scale(int value, int from, int to)
+{
+    return from > to ? value >> (from - to) : value << (to - from);
+}
+
+static void adc_set_winmode(Adc *adc, int mode)
+{
+#ifdef SAMD21
+    adc->WINCTRL.reg = ADC_WINCTRL_WINMODE(mode);
+#else
+    adc->CTRLB.bit.WINMODE = mode;
+#endif
+    adc_sync(adc);
+}
+
+static void adc_irq_handler(int index)
+{
+    SAMDADC::getInstance(index)->windowInterrupt();
+}
+
+#ifdef SAMD21
+extern "C" void ADC_Handler(void)
+{
+    adc_irq_handler(0);
+}
+#else
+// the window monitor is on each ADC's first vector (OVERRUN and WINMON), RESRDY on the second.
+extern "C" void ADC0_0_Handler(void)
+{
+    adc_irq_handler(0);
+}
+
+extern "C" void ADC1_0_Handler(void)
+{
+    adc_irq_handler(1);
+}
+#endif
+
+static inline int adc_resrdy_trigger(int index)
+{
+#ifdef SAMD21
+    return ADC_DMAC_ID_RESRDY;
+#else
+    return index ? ADC1_DMAC_ID_RESRDY : ADC0_DMAC_ID_RESRDY;
+#endif
+}
+
+/**
+ * Update our reference to a downstream component.
+ * Pass through any connect requests to our output buffer component.
+ *
+ * @param component The new downstream component for this ADC.
+ */
+void SAMDADC::connect(DataSink& component)
+{
+    output.connect(component);
+}
+
+SAMDADC::SAMDADC(int index, uint16_t id) : output(*this)
+{
+    this->id = id;
+    this->index = index;
+    this->enabled = false;
+    this->sampleRate = SAMDADC_DEFAULT_FREQUENCY;
+    this->overruns = 0;
+    this->inputCount = 0;
+    this->raw[0] = NULL;
+    this->raw[1] = NULL;
+    this->ready = -1;
+    this->tc = SAMDADC_TC;
+    this->resultDma = NULL;
+    this->scanDma = NULL;
+    this->startEvent = NULL;
+    this->scanEvent = NULL;
+    this->windowHandler = NULL;
+    this->windowArg = NULL;
+
+#ifdef SAMD21
+    adc = ADC;
+#else
+    adc = index ? ADC1 : ADC0;
+#endif
+
+    // Bring the ADC up once, and leave it running with single ended inputs; the rest of the
+    // configuration is applied by the first conversion.
+    adc_sync_descriptor *descriptor = &adc_descriptors[index];
+    memset(descriptor, 0, sizeof(*descriptor));
+
+    samd_peripherals_adc_setup(descriptor, adc);
+
+    adc_sync_set_inputs(descriptor, 0, ADC_INPUTCTRL_MUXNEG_GND_Val, 0);
+    adc_sync_enable_channel(descriptor, 0);
+
+    // match nothing, so every setting is written the first time.
+    memset(&current, 0xff, sizeof(current));
+
+    // Create a listener to receive data ready events from our ISR.
+    if(EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(id, SAMDADC_DATA_READY, this, &SAMDADC::sendData);
+}
+
+SAMDADC* SAMDADC::getInstance(int index)
+{
+    if (index < 0 || index >= SAMDADC_INSTANCES)
+        return NULL;
+
+    if (instances[index] == NULL)
+        instances[index] = new SAMDADC(index);
+
+    return instances[index];
+}
+
+int SAMDADC::lookup(PinNumber name, SAMDADC *&adc)
+{
+    const mcu_pin_obj_t* pin = samd_peripherals_get_pin(name);
+
+    for (int i = 0; i < SAMDADC_INSTANCES; i++)
+    {
+        if (pin->adc_input[i] != 0xff)
+        {
+            adc = getInstance(i);
+            return pin->adc_input[i];
+        }
+    }
+
+    return DEVICE_NOT_SUPPORTED;
+}
+
+/**
+ * Reprograms whatever differs between the given configuration and the current one.
+ *
+ * @return true if the reference changed, in which case the next result is garbage.
+ */
+bool SAMDADC::apply(const SAMDADCConfig &config)
+{
+    bool settle = false;
+
+    if (config.reference != current.reference)
+    {
+        adc->REFCTRL.bit.REFSEL = config.reference;
+        adc_sync(adc);
+        settle = true;
+    }
+
+#ifdef SAMD21
+    if (config.gain != current.gain)
+    {
+        adc->INPUTCTRL.bit.GAIN = config.gain;
+        adc_sync(adc);
+    }
+#endif
+
+    if (config.resolution != current.resolution || config.samples != current.samples)
+    {
+        int ressel;
+
+        if (config.samples > 1)
+            ressel = ADC_CTRLB_RESSEL_16BIT_Val;
+        else if (config.resolution == 8)
+            ressel = ADC_CTRLB_RESSEL_8BIT_Val;
+        else if (config.resolution == 10)
+            ressel = ADC_CTRLB_RESSEL_10BIT_Val;
+        else
+            ressel = ADC_CTRLB_RESSEL_12BIT_Val;
+
+        adc->CTRLB.bit.RESSEL = ressel;
+        adc_sync(adc);
+
+        // results are scaled in software, so the hardware doesn't shift beyond what's needed to fit.
+        adc->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM(__builtin_ctz(config.samples)) | ADC_AVGCTRL_ADJRES(0);
+        adc_sync(adc);
+    }
+
+    if (config.sampleTime != current.sampleTime)
+    {
+        adc->SAMPCTRL.bit.SAMPLEN = config.sampleTime;
+        adc_sync(adc);
+    }
+
+    current = config;
+
+    return settle;
+}
+
+int SAMDADC::read(int input)
+{
+    return read(input, SAMDADCConfig());
+}
+
+int SAMDADC::read(int input, const SAMDADCConfig &config)
+{
+    // the ADC belongs to the stream while it's running.
+    if (enabled)
+        return DEVICE_BUSY;
+
+    if (!isValid(config))
+        return DEVICE_INVALID_PARAMETER;
+
+    // the window monitor keeps converting its input, so use the latest result.
+    if (windowHandler)
+    {
+        if (input != windowInput)
+            return DEVICE_BUSY;
+
+        adc->INTFLAG.reg = ADC_INTFLAG_RESRDY;
+        while (!(adc->INTFLAG.reg & ADC_INTFLAG_RESRDY));
+        adc_sync(adc);
+
+        return adc_scale(adc->RESULT.reg, adc_result_bits(current), config.resolution);
+    }
+
+    // first result after selecting the reference is always garbage, according to the datasheet
+    if (apply(config))
+        adc_convert(adc, input);
+
+    int result = adc_convert(adc, input);
+
+    return adc_scale(result, adc_result_bits(config), config.resolution);
+}
+
+int SAMDADC::startWindow(int input, const SAMDADCConfig &config, int low, int high, SAMDADCWindowHandler handler, void *arg)
+{
+    if (enabled || (windowHandler && windowArg != arg))
+        return DEVICE_BUSY;
+
+    if (!isValid(config) || low > high || low < 0 || handler == NULL)
+        return DEVICE_INVALID_PARAMETER;
+
+    stopWindow(arg);
+
+    if (apply(config))
+        adc_convert(adc, input);
+
+    // compare against raw results, so nothing needs scaling in the interrupt.
+    int bits = adc_result_bits(config);
+    low = adc_scale(low, config.resolution, bits);
+    high = adc_scale(high, config.resolution, bits);
+
+    // start on whichever side of the window we're on now, so only crossings are reported.
+    windowAbove = adc_convert(adc, input) > high;
+
+    // MODE1 matches results above WINLT, MODE2 results below WINUT; each watches for leaving
+    // the side we're on.
+    adc->WINLT.reg = high;
+    adc_sync(adc);
+    adc->WINUT.reg = low;
+    adc_sync(adc);
+    adc_set_winmode(adc, windowAbove ? 2 : 1);
+
+    windowInput = input;
+    windowArg = arg;
+    windowHandler = handler;
+
+    adc->CTRLB.bit.FREERUN = 1;
+    adc_sync(adc);
+
+    adc->INTFLAG.reg = ADC_INTFLAG_WINMON;
+    adc->INTENSET.reg = ADC_INTENSET_WINMON;
+#ifdef SAMD21
+    NVIC_EnableIRQ(ADC_IRQn);
+    adc->SWTRIG.reg = ADC_SWTRIG_START;
+#else
+    NVIC_EnableIRQ(index ? ADC1_0_IRQn : ADC0_0_IRQn);
+    adc->SWTRIG.bit.START = 1;
+#endif
+
+    return DEVICE_OK;
+}
+
+void SAMDADC::stopWindow(void *arg)
+{
+    if (windowHandler == NULL || windowArg != arg)
+        return;
+
+    adc->INTENCLR.reg = ADC_INTENCLR_WINMON;
+
+    // the conversion in progress completes, and is the last.
+    adc->CTRLB.bit.FREERUN = 0;
+    adc_sync(adc);
+    adc_set_winmode(adc, 0);
+
+    windowHandler = NULL;
+    windowArg = NULL;
+}
+
+void SAMDADC::windowInterrupt()
+{
+    if (!(adc->INTFLAG.reg & ADC_INTFLAG_WINMON))
+        return;
+
+    adc->INTFLAG.reg = ADC_INTFLAG_WINMON;
+
+    if (windowHandler == NULL)
+        return;
+
+    // now watch for crossing back the other way.
+    windowAbove = !windowAbove;
+    adc_set_winmode(adc, windowAbove ? 2 : 1);
+
+    windowHandler(windowArg, windowAbove);
+}
+
+int SAMDADC::configureStream(const SAMDADCConfig &config)
+{
+    if (enabled)
+        return DEVICE_BUSY;
+
+    if (!isValid(config))
+        return DEVICE_INVALID_PARAMETER;
+
+    streamConfig = config;
+
+    return DEVICE_OK;
+}
+
+int SAMDADC::addChannel(ZPin &pin)
+{
+    if (enabled)
+        return DEVICE_BUSY;
+
+    SAMDADC *owner = NULL;
+    int input = lookup(pin.name, owner);
+
+    if (input < 0 || owner != this)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (inputCount == SAMDADC_MAX_CHANNELS)
+        return DEVICE_NO_RESOURCES;
+
+    // put the pin into analogue mode.
+    pin.getAnalogValue();
+
+    inputs[inputCount++] = input;
+
+    return DEVICE_OK;
+}
+
+int SAMDADC::clearChannels()
+{
+    if (enabled)
+        return DEVICE_BUSY;
+
+    inputCount = 0;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Change the rate at which the pins are sampled while streaming.
+ * n.b. The conversion period is a whole number of timer ticks, from 125nS on upwards.
+ * Frequencies matching other periods will be rounded to the next highest supported frequency.
+ *
+ * @param frequency The new sample rate, per pin.
+ */
+int SAMDADC::setSampleRate(int frequency)
+{
+    if (frequency <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    // the timer starts one conversion per tick, and a scan converts every input.
+    uint32_t inputs = inputCount ? inputCount : 1;
+    if ((uint32_t)frequency > 8000000 / inputs)
+        return DEVICE_INVALID_PARAMETER;
+
+    uint32_t rate = frequency * inputs;
+
+    // the slowest prescaler that still gives the rate, as a power of two: DIV1 to DIV1024.
+    static const uint8_t prescaler_shifts[] = { 0, 1, 2, 3, 4, 6, 8, 10 };
+    uint32_t prescaler = 0;
+    uint32_t period = 8000000 / rate;
+
+    while (period > 0x10000 && prescaler < 7)
+        period = (8000000 >> prescaler_shifts[++prescaler]) / rate;
+
+    // the timer needs at least two ticks per conversion, and at most 0x10000.
+    if (period < 2 || period > 0x10000)
+        return DEVICE_INVALID_PARAMETER;
+
+    sampleRate = frequency;
+
+    if (enabled)
+    {
+        tc_set_enable(tc, false);
+        tc->COUNT16.CTRLA.bit.PRESCALER = prescaler;
+        // the timer counts from 0 to CC0 inclusive.
+        tc->COUNT16.CC[0].reg = period - 1;
+        tc_set_enable(tc, true);
+    }
+
+    return DEVICE_OK;
+}
+
+int SAMDADC::getSampleRate()
+{
+    return sampleRate;
+}
+
+uint32_t SAMDADC::getOverruns()
+{
+    return overruns;
+}
+
+void SAMDADC::release()
+{
+    if (resultDma)
+        delete resultDma;
+    if (scanDma)
+        delete scanDma;
+    if (startEvent)
+        delete startEvent;
+    if (scanEvent)
+        delete scanEvent;
+
+    resultDma = NULL;
+    scanDma = NULL;
+    startEvent = NULL;
+    scanEvent = NULL;
+}
+
+int SAMDADC::enable()
+{
+    if (enabled)
+        return DEVICE_OK;
+
+    if (inputCount == 0)
+        return DEVICE_INVALID_STATE;
+
+    if (windowHandler)
+        return DEVICE_BUSY;
+
+    // Scanning needs a second DMA channel, to select each input in turn as the last result
+    // lands. It's driven by the result ready event, so has to be one that accepts events -
+    // the low numbered ones, which is why it's allocated first.
+    if (inputCount > 1)
+    {
+        scanDma = DmaFactory::allocate(DmaPriorityHigh);
+        scanEvent = EvsysFactory::allocate(true);
+    }
+
+    // samples are lost if a result isn't collected before the next one, so let capture
+    // preempt bulk transfers.
+    resultDma = DmaFactory::allocate(DmaPriorityHigh);
+    startEvent = EvsysFactory::allocate();
+
+    if (resultDma == NULL || startEvent == NULL ||
+        (inputCount > 1 && (scanDma == NULL || scanEvent == NULL || dma_event_user(scanDma->channel_number) < 0)))
+    {
+        DMESG("ADC: no DMA or event channel");
+        release();
+        return DEVICE_NO_RESOURCES;
+    }
+
+    if (raw[0] == NULL)
+    {
+        raw[0] = new uint16_t[SAMDADC_BUFFER_SAMPLES];
+        raw[1] = new uint16_t[SAMDADC_BUFFER_SAMPLES];
+    }
+
+    // whole scans only, so every buffer starts with the first pin.
+    rawSize = (SAMDADC_BUFFER_SAMPLES / inputCount) * inputCount * sizeof(uint16_t);
+
+    apply(streamConfig);
+
+    // The first input is selected now; entry n of the scan table is the input to select once
+    // conversion n completes.
+    uint32_t inputctrl = adc->INPUTCTRL.reg & ~ADC_INPUTCTRL_MUXPOS_Msk;
+
+    for (int i = 0; i < inputCount; i++)
+        scanTable[i].reg = inputctrl | ADC_INPUTCTRL_MUXPOS(inputs[(i + 1) % inputCount]);
+
+    adc->INPUTCTRL.reg = inputctrl | ADC_INPUTCTRL_MUXPOS(inputs[0]);
+    adc_sync(adc);
+
+    filling = 0;
+    ready = -1;
+
+    resultDma->configure(adc_resrdy_trigger(index), BeatHalfWord, &adc->RESULT.reg, NULL);
+    resultDma->onTransferComplete(dma_member_handler<SAMDADC>, this);
+    resultDma->transfer(NULL, raw[filling], rawSize);
+
+    if (scanDma)
+    {
+        scanDma->configure(0, sizeof(ADC_INPUTCTRL_Type) == 4 ? BeatWord : BeatHalfWord, NULL, &adc->INPUTCTRL.reg);
+        scanDma->setEventInput(DmaEventTrigger);
+        scanDma->startCircular(scanTable, inputCount * sizeof(ADC_INPUTCTRL_Type), false);
+
+        scanEvent->setGenerator(adc_resrdy_event_gen(index), EvsysPathResync, EvsysEdgeRise);
+        scanEvent->addUser(dma_event_user(scanDma->channel_number));
+    }
+
+    adc_set_evctrl(adc, ADC_EVCTRL_STARTEI | (scanDma ? ADC_EVCTRL_RESRDYEO : 0));
+
+    // Use a timer to coordinate when conversions occur, starting each one through the event system.
+    uint8_t tc_index = 0;
+    while (tc_index < TC_INST_NUM)
+    {
+        if (tc_insts[tc_index] == this->tc)
+            break;
+        tc_index++;
+    }
+    CODAL_ASSERT(tc_index < TC_INST_NUM, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+
+    // Nothing hands the timers out, so at least make sure no one else is running this one.
+    CODAL_ASSERT(!tc->COUNT16.CTRLA.bit.ENABLE, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+    tc_set_enable(tc, false);
+    turn_on_clocks(true, tc_index, CLK_GEN_8MHZ);
+    tc_reset(tc);
+
+    tc->COUNT16.CTRLA.bit.MODE = 0;
+#ifdef SAMD51
+    tc->COUNT16.WAVE.reg = TC_WAVE_WAVEGEN_MFRQ;
+#endif
+#ifdef SAMD21
+    tc->COUNT16.CTRLA.bit.WAVEGEN = TC_CTRLA_WAVEGEN_MFRQ_Val;
+#endif
+    tc->COUNT16.CTRLA.bit.PRESCALER = 0;
+    tc->COUNT16.EVCTRL.reg = TC_EVCTRL_OVFEO;
+    tc->COUNT16.CTRLBCLR.bit.DIR = 1; // count up
+
+    startEvent->setGenerator(tc_overflow_event_gen(tc_index), EvsysPathAsync);
+    startEvent->addUser(adc_start_event_user(index));
+
+    enabled = true;
+
+    // start the timer. With more inputs than when the rate was set, it may be out of reach.
+    int result = setSampleRate(sampleRate);
+    if (result != DEVICE_OK)
+        disable();
+
+    return result;
+}
+
+void SAMDADC::disable()
+{
+    if (!enabled)
+        return;
+
+    tc_set_enable(tc, false);
+
+    enabled = false;
+
+    resultDma->abort();
+    if (scanDma)
+        scanDma->abort();
+
+    adc_set_evctrl(adc, 0);
+
+    release();
+
+    // leave the ADC as single conversions expect to find it.
+    adc->INTFLAG.reg = ADC_INTFLAG_RESRDY;
+}
+
+/**
+ * Provide the next available ManagedBuffer to our downstream caller, if available.
+ */
+ManagedBuffer SAMDADC::pull()
+{
+    return buffer;
+}
+
+void SAMDADC::sendData(Event)
+{
+    int r = ready;
+
+    // the event is shared by every ADC, so it may not be ours.
+    if (r < 0)
+        return;
+
+    ready = -1;
+
+    buffer = ManagedBuffer((uint8_t *)raw[r], rawSize);
+    output.pullRequest();
+}
+
+void SAMDADC::dmaTransferComplete(DmaCode c)
+{
+    if (!enabled)
+        return;
+
+    if (c == DMA_ERROR)
+    {
+        DMESG("ADC: DMA error");
+        return;
+    }
+
+    // restart straight away: a result that lands meanwhile just waits for the channel.
+    int done = filling;
+    filling = done ^ 1;
+    resultDma->transfer(NULL, raw[filling], rawSize);
+
+    // if the previous buffer still hasn't been sent, it's the one being overwritten now.
+    if (ready >= 0)
+        overruns++;
+
+    ready = done;
+    Event(id, SAMDADC_DATA_READY);
+}
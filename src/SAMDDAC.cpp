@@ -159,12 +159,19 @@ SAMDDAC::SAMDDAC(ZPin &pin, DataSource &source, int sampleRate, uint16_t id, uin
     setSampleRate(sampleRate);
 
 
+    // audio underruns are audible, so let playback preempt bulk transfers.
     DmaFactory factory;
-    dmaInstance = factory.allocate();
-    CODAL_ASSERT(dmaInstance != NULL, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+    dmaInstance = factory.allocate(DmaPriorityHigh);
 
-    dmaInstance->onTransferComplete(this);
-    dmaInstance->configure(TC3_DMAC_ID_OVF, BeatHalfWord, NULL, (volatile void *)&DAC_DATA);
+    if (dmaInstance)
+    {
+        dmaInstance->onTransferComplete(dma_member_handler<SAMDDAC>, this);
+        dmaInstance->configure(TC3_DMAC_ID_OVF, BeatHalfWord, NULL, (volatile void *)&DAC_DATA);
+    }
+    else
+    {
+        DMESG("DAC: no DMA channel");
+    }
 
     // Register with our upstream component
     source.connect(*this);
@@ -237,6 +244,9 @@ void SAMDDAC::prefill()
  */
 int SAMDDAC::pull()
 {
+    if (dmaInstance == NULL)
+        return DEVICE_NO_RESOURCES;
+
     if (!nextBuffer.length())
         prefill();
 
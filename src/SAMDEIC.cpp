@@ -10,22 +10,91 @@ extern "C"
 using namespace codal;
 
 EICFactory* EICFactory::instance = NULL;
+EICChannel EICFactory::channels[EIC_CHANNEL_COUNT];
 EICChannel* EICFactory::instances[EIC_CHANNEL_COUNT];
 
+// PORT_IOBUS reaches IN in a single cycle, where it has one.
+#ifdef PORT_IOBUS
+#define EIC_PORT PORT_IOBUS
+#else
+#define EIC_PORT PORT
+#endif
+
+// what to call for each line, and where the level of its pin is found in PORT IN. Volatile,
+// as setHandler() relies on the order of its writes rather than masking interrupts.
+static EICLineHandler volatile handlers[EIC_CHANNEL_COUNT];
+static void* volatile handlerArgs[EIC_CHANNEL_COUNT];
+static volatile uint8_t handlerPorts[EIC_CHANNEL_COUNT];
+static volatile uint32_t handlerMasks[EIC_CHANNEL_COUNT];
+
 void EICInterface::pinEventDetected() {}
 
+static void eic_interface_handler(void *arg, bool)
+{
+    ((EICInterface *)arg)->pinEventDetected();
+}
+
+#ifdef SAMD21
+// the SAMD21 has a single interrupt shared by all the lines, so we take it over to serve every
+// line that fired in one go.
+extern "C" void EIC_Handler()
+{
+    uint32_t extint = EIC->INTFLAG.vec.EXTINT;
+    EIC->INTFLAG.vec.EXTINT = extint;
+
+    // one sample of every pin, taken as close to the edges as we can.
+    uint32_t in[2] = { EIC_PORT->Group[0].IN.reg, EIC_PORT->Group[1].IN.reg };
+
+    // visit only the lines that fired, lowest first.
+    while (extint)
+    {
+        int i = __builtin_ctz(extint);
+        extint &= extint - 1;
+
+        EICLineHandler handler = handlers[i];
+        if (handler)
+            handler(handlerArgs[i], (in[handlerPorts[i]] & handlerMasks[i]) != 0);
+    }
+}
+#endif
+
+// on the SAMD51 each line has its own interrupt, which ends up here.
 static void eic_handler(uint8_t channel)
 {
-    if (EICFactory::instance && EICFactory::instance->instances[channel])
-        EICFactory::instance->instances[channel]->trigger();
+    EICLineHandler handler = handlers[channel];
+    if (handler)
+        handler(handlerArgs[channel], (EIC_PORT->Group[handlerPorts[channel]].IN.reg & handlerMasks[channel]) != 0);
 }
 
+#ifdef SAMD51
+/**
+ * Turns the debouncer of an EIC channel on or off.
+ */
+static void eic_set_debounce(int channel, bool enable)
+{
+    // DEBOUNCEN can only be written while the EIC is stopped.
+    eic_set_enable(false);
+
+    if (enable)
+        EIC->DEBOUNCEN.reg |= 1 << channel;
+    else
+        EIC->DEBOUNCEN.reg &= ~(1 << channel);
 
-EICChannel::EICChannel(int channel)
+    eic_set_enable(true);
+}
+#endif
+
+EICChannel::EICChannel()
 {
     this->cb = NULL;
-    turn_on_cpu_interrupt(channel);
-    this->channel_number = channel;
+    this->channel_number = this - EICFactory::channels;
+    this->configuration = EICEventsNone;
+    this->filter = EICFilterNone;
+}
+
+int EICChannel::getChannel()
+{
+    return this->channel_number;
 }
 
 void EICChannel::trigger()
@@ -34,10 +103,23 @@ void EICChannel::trigger()
         this->cb->pinEventDetected();
 }
 
+/**
+ * The CONFIG setting of a line: its sense, with the majority filter if asked for.
+ */
+static uint32_t eic_sense(EICEventType t, EICFilter filter)
+{
+    uint32_t sense = t;
+
+    if (t != EICEventsNone && filter == EICFilterMajority)
+        sense |= EIC_CONFIG_FILTEN0;
+
+    return sense;
+}
+
 void EICChannel::configure(EICEventType t)
 {
     this->configuration = t;
-    configure_eic_channel(this->channel_number, t);
+    configure_eic_channel(this->channel_number, eic_sense(t, filter));
 }
 
 EICEventType EICChannel::getConfiguration()
@@ -50,17 +132,49 @@ void EICChannel::disable()
     configure(EICEventsNone);
 }
 
+int EICChannel::setFilter(EICFilter f)
+{
+#ifdef SAMD21
+    if (f == EICFilterDebounce)
+        return DEVICE_NOT_SUPPORTED;
+#else
+    if ((f == EICFilterDebounce) != (this->filter == EICFilterDebounce))
+        eic_set_debounce(this->channel_number, f == EICFilterDebounce);
+#endif
+
+    this->filter = f;
+
+    if (this->configuration != EICEventsNone)
+        configure(this->configuration);
+
+    return DEVICE_OK;
+}
+
 void EICChannel::setChangeCallback(EICInterface* interface)
 {
-    target_disable_irq();
+    setHandler(interface ? eic_interface_handler : NULL, interface, -1);
     this->cb = interface;
-    target_enable_irq();
+}
+
+void EICChannel::setHandler(EICLineHandler handler, void *arg, int pin)
+{
+    int ch = this->channel_number;
+
+    this->cb = NULL;
+
+    // the handler goes last, so the interrupt never sees it with another's argument.
+    handlers[ch] = NULL;
+    handlerArgs[ch] = arg;
+    handlerPorts[ch] = pin < 0 ? 0 : pin / 32;
+    handlerMasks[ch] = pin < 0 ? 0 : 1UL << (pin % 32);
+    handlers[ch] = handler;
 }
 
 void EICChannel::enable(EICEventType t)
 {
-    configure(t);
-    turn_on_eic_channel(this->channel_number, t, EIC_HANDLER_APP);
+    // this writes the line's CONFIG too, so has to be given the filter as well as the sense.
+    this->configuration = t;
+    turn_on_eic_channel(this->channel_number, eic_sense(t, filter), EIC_HANDLER_APP);
 }
 
 EICFactory* EICFactory::getInstance()
@@ -81,6 +195,15 @@ EICFactory::EICFactory()
 
     eic_reset();
 
+#ifdef SAMD21
+    NVIC_SetPriority(EIC_IRQn, 0);
+#else
+    // debounced lines are sampled from the always-on 32kHz clock, and need 7 equal samples.
+    EIC->DPRESCALER.reg = EIC_DPRESCALER_TICKON |
+                          EIC_DPRESCALER_STATES0 | EIC_DPRESCALER_PRESCALER0(EIC_DEBOUNCE_PRESCALER) |
+                          EIC_DPRESCALER_STATES1 | EIC_DPRESCALER_PRESCALER1(EIC_DEBOUNCE_PRESCALER);
+#endif
+
     enable();
 }
 
@@ -96,21 +219,61 @@ void EICFactory::enable()
 
 EICChannel* EICFactory::getChannel(int channel)
 {
-    if (instance->instances[channel] == NULL)
-    {
-        target_disable_irq();
-        EICFactory::instances[channel] = new EICChannel(channel);
-        target_enable_irq();
-        return EICFactory::instances[channel];
-    }
+    if (instances[channel])
+        return NULL;
 
-    return instance->instances[channel];
+    turn_on_cpu_interrupt(channel);
+    instances[channel] = &channels[channel];
+
+    return instances[channel];
 }
 
 void EICFactory::free(int channel)
 {
-    target_disable_irq();
-    delete EICFactory::instances[channel];
-    EICFactory::instances[channel] = NULL;
-    target_enable_irq();
+    EICChannel *c = &channels[channel];
+
+    c->disable();
+    c->setHandler(NULL, NULL, -1);
+    c->setFilter(EICFilterNone);
+
+    instances[channel] = NULL;
+}
+
+/**
+ * Turns the event output of an EIC channel on or off.
+ */
+static void eic_set_event_output(int channel, bool enable)
+{
+#ifdef SAMD51
+    // EVCTRL can only be written while the EIC is stopped.
+    eic_set_enable(false);
+#endif
+
+    if (enable)
+        EIC->EVCTRL.reg |= EIC_EVCTRL_EXTINTEO(1 << channel);
+    else
+        EIC->EVCTRL.reg &= ~EIC_EVCTRL_EXTINTEO(1 << channel);
+
+#ifdef SAMD51
+    eic_set_enable(true);
+#endif
+}
+
+int codal::eic_enable_level_event(int channel)
+{
+    // the factory brings the EIC up, and the line is held like any other so no one else takes it.
+    EICChannel *c = EICFactory::getInstance()->getChannel(channel);
+    if (c == NULL)
+        return DEVICE_BUSY;
+
+    c->configure(EICEventsHigh);
+    eic_set_event_output(channel, true);
+
+    return DEVICE_OK;
+}
+
+void codal::eic_disable_level_event(int channel)
+{
+    eic_set_event_output(channel, false);
+    EICFactory::getInstance()->free(channel);
 }
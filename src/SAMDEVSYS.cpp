@@ -0,0 +1,297 @@
+#include "SAMDEVSYS.h"
+#include "codal_target_hal.h"
+#include "CodalDmesg.h"
+#include "ErrorNo.h"
+
+extern "C"
+{
+#include "clocks.h"
+}
+
+#undef ENABLE
+
+using namespace codal;
+
+bool EvsysFactory::initialised = false;
+EvsysChannel* EvsysFactory::channels[EVSYS_CHANNEL_COUNT];
+EvsysHandler EvsysFactory::handlers[EVSYS_SYNC_CHANNEL_COUNT];
+void* EvsysFactory::handlerArgs[EVSYS_SYNC_CHANNEL_COUNT];
+
+#ifdef SAMD21
+// the EVD bits of INTENSET/INTENCLR/INTFLAG are split in two groups.
+static inline uint32_t evsys_evd_mask(int channel)
+{
+    return channel < 8 ? (1u << (8 + channel)) : (1u << (24 + channel - 8));
+}
+
+// USER is written to select a user before it can be read back.
+static inline int evsys_user_channel(int user)
+{
+    *(volatile uint8_t *)&EVSYS->USER.reg = user;
+    return EVSYS->USER.bit.CHANNEL;
+}
+#endif
+
+static void evsys_irq_handler()
+{
+#ifdef SAMD21
+    uint32_t flags = EVSYS->INTFLAG.reg & EVSYS->INTENSET.reg;
+    EVSYS->INTFLAG.reg = flags;
+
+    for (int channel = 0; channel < EVSYS_SYNC_CHANNEL_COUNT; channel++)
+        if ((flags & evsys_evd_mask(channel)) && EvsysFactory::handlers[channel])
+            EvsysFactory::handlers[channel](EvsysFactory::handlerArgs[channel]);
+#else
+    uint32_t pending;
+
+    while ((pending = EVSYS->INTSTATUS.reg) != 0)
+    {
+        while (pending)
+        {
+            int channel = __builtin_ctz(pending);
+            pending &= pending - 1;
+
+            EVSYS->Channel[channel].CHINTFLAG.reg = EVSYS_CHINTFLAG_MASK;
+
+            if (EvsysFactory::handlers[channel])
+                EvsysFactory::handlers[channel](EvsysFactory::handlerArgs[channel]);
+        }
+    }
+#endif
+}
+
+#ifdef SAMD21
+extern "C" void EVSYS_Handler(void)
+{
+    evsys_irq_handler();
+}
+#else
+extern "C" void EVSYS_0_Handler(void)
+{
+    evsys_irq_handler();
+}
+
+extern "C" void EVSYS_1_Handler(void)
+{
+    evsys_irq_handler();
+}
+
+extern "C" void EVSYS_2_Handler(void)
+{
+    evsys_irq_handler();
+}
+
+extern "C" void EVSYS_3_Handler(void)
+{
+    evsys_irq_handler();
+}
+
+extern "C" void EVSYS_4_Handler(void)
+{
+    evsys_irq_handler();
+}
+#endif
+
+EvsysChannel::EvsysChannel(int channel)
+{
+    this->channel_number = channel;
+    this->configuration = 0;
+}
+
+int EvsysChannel::setGenerator(int generator, EvsysPath path, EvsysEdge edge)
+{
+    if (path != EvsysPathAsync && channel_number >= EVSYS_SYNC_CHANNEL_COUNT)
+        return DEVICE_NOT_SUPPORTED;
+
+    if (path == EvsysPathAsync)
+    {
+        // edge detection needs a clock, which the asynchronous path doesn't have.
+        edge = EvsysEdgeNone;
+    }
+    else
+    {
+        // the synchronous paths are clocked per channel, and output nothing without an edge to detect.
+        connect_gclk_to_peripheral(CLK_GEN_48MHZ, EVSYS_GCLK_ID_0 + channel_number);
+
+        if (edge == EvsysEdgeNone)
+            edge = EvsysEdgeRise;
+    }
+
+#ifdef SAMD21
+    configuration = EVSYS_CHANNEL_CHANNEL(channel_number) | EVSYS_CHANNEL_EVGEN(generator) |
+                    EVSYS_CHANNEL_PATH(path) | EVSYS_CHANNEL_EDGSEL(edge);
+    EVSYS->CHANNEL.reg = configuration;
+#else
+    configuration = EVSYS_CHANNEL_EVGEN(generator) | EVSYS_CHANNEL_PATH(path) |
+                    EVSYS_CHANNEL_EDGSEL(edge);
+    EVSYS->Channel[channel_number].CHANNEL.reg = configuration;
+#endif
+
+    return DEVICE_OK;
+}
+
+int EvsysChannel::addUser(int user)
+{
+    if (user < 0 || user >= EVSYS_USERS)
+        return DEVICE_INVALID_PARAMETER;
+
+    // user channel numbers are offset by one, zero meaning no channel.
+#ifdef SAMD21
+    EVSYS->USER.reg = EVSYS_USER_USER(user) | EVSYS_USER_CHANNEL(channel_number + 1);
+#else
+    EVSYS->USER[user].reg = EVSYS_USER_CHANNEL(channel_number + 1);
+#endif
+
+    return DEVICE_OK;
+}
+
+int EvsysChannel::removeUser(int user)
+{
+    if (user < 0 || user >= EVSYS_USERS)
+        return DEVICE_INVALID_PARAMETER;
+
+#ifdef SAMD21
+    if (evsys_user_channel(user) != channel_number + 1)
+        return DEVICE_INVALID_PARAMETER;
+
+    EVSYS->USER.reg = EVSYS_USER_USER(user);
+#else
+    if (EVSYS->USER[user].bit.CHANNEL != channel_number + 1)
+        return DEVICE_INVALID_PARAMETER;
+
+    EVSYS->USER[user].reg = 0;
+#endif
+
+    return DEVICE_OK;
+}
+
+void EvsysChannel::trigger()
+{
+#ifdef SAMD21
+    // the whole register is written, so the configuration has to go with the software event.
+    EVSYS->CHANNEL.reg = configuration | EVSYS_CHANNEL_SWEVT;
+#else
+    EVSYS->SWEVT.reg = 1 << channel_number;
+#endif
+}
+
+int EvsysChannel::onEventDetected(EvsysHandler handler, void *arg)
+{
+    if (channel_number >= EVSYS_SYNC_CHANNEL_COUNT)
+        return DEVICE_NOT_SUPPORTED;
+
+#ifdef SAMD21
+    EVSYS->INTENCLR.reg = evsys_evd_mask(channel_number);
+#else
+    EVSYS->Channel[channel_number].CHINTENCLR.reg = EVSYS_CHINTENCLR_EVD;
+#endif
+
+    EvsysFactory::handlers[channel_number] = handler;
+    EvsysFactory::handlerArgs[channel_number] = arg;
+
+    if (handler)
+    {
+#ifdef SAMD21
+        EVSYS->INTFLAG.reg = evsys_evd_mask(channel_number);
+        EVSYS->INTENSET.reg = evsys_evd_mask(channel_number);
+#else
+        EVSYS->Channel[channel_number].CHINTFLAG.reg = EVSYS_CHINTFLAG_EVD;
+        EVSYS->Channel[channel_number].CHINTENSET.reg = EVSYS_CHINTENSET_EVD;
+#endif
+    }
+
+    return DEVICE_OK;
+}
+
+int EvsysChannel::getChannel()
+{
+    return channel_number;
+}
+
+EvsysChannel::~EvsysChannel()
+{
+    if (channel_number < EVSYS_SYNC_CHANNEL_COUNT)
+        onEventDetected(NULL, NULL);
+
+    for (int user = 0; user < EVSYS_USERS; user++)
+        removeUser(user);
+
+    setGenerator(0, EvsysPathAsync);
+
+    EvsysFactory::free(this);
+}
+
+void EvsysFactory::instantiate()
+{
+    if (initialised)
+        return;
+
+    initialised = true;
+
+    memset(channels, 0, sizeof(channels));
+    memset(handlers, 0, sizeof(handlers));
+
+#ifdef SAMD21
+    PM->APBCMASK.reg |= PM_APBCMASK_EVSYS;
+
+    EVSYS->CTRL.reg = EVSYS_CTRL_SWRST;
+    while (EVSYS->CTRL.bit.SWRST);
+
+    NVIC_EnableIRQ(EVSYS_IRQn);
+#else
+    MCLK->APBBMASK.reg |= MCLK_APBBMASK_EVSYS;
+
+    EVSYS->CTRLA.reg = EVSYS_CTRLA_SWRST;
+    while (EVSYS->CTRLA.bit.SWRST);
+
+    for (int i = 0; i < 5; ++i)
+        NVIC_EnableIRQ((IRQn_Type)(EVSYS_0_IRQn + i));
+#endif
+}
+
+EvsysChannel* EvsysFactory::allocate(bool synchronous)
+{
+    instantiate();
+
+    target_disable_irq();
+
+    int channel = -1;
+
+    // keep the channels that can do more for those who need them.
+    if (synchronous)
+    {
+        for (int i = 0; i < EVSYS_SYNC_CHANNEL_COUNT && channel < 0; i++)
+            if (channels[i] == NULL)
+                channel = i;
+    }
+    else
+    {
+        for (int i = EVSYS_CHANNEL_COUNT - 1; i >= 0 && channel < 0; i--)
+            if (channels[i] == NULL)
+                channel = i;
+    }
+
+    if (channel >= 0)
+        channels[channel] = new EvsysChannel(channel);
+
+    target_enable_irq();
+
+    if (channel < 0)
+    {
+        DMESG("EVSYS: no free channels");
+        return NULL;
+    }
+
+    return channels[channel];
+}
+
+void EvsysFactory::free(EvsysChannel* channel)
+{
+    target_disable_irq();
+
+    for (int i = 0; i < EVSYS_CHANNEL_COUNT; i++)
+        if (channels[i] == channel)
+            channels[i] = NULL;
+
+    target_enable_irq();
+}
@@ -85,8 +85,10 @@ void SAMD21PDM::connect(DataSink& component)
  */
 SAMD21PDM::SAMD21PDM(ZPin &sd, ZPin &sck, int sampleRate, uint16_t id) : output(*this)
 {
-    dma = DmaFactory::allocate();
-    CODAL_ASSERT(dma != NULL, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+    // samples are lost if the I2S receiver overflows, so let capture preempt bulk transfers.
+    dma = DmaFactory::allocate(DmaPriorityHigh);
+    if (dma == NULL)
+        DMESG("PDM: no DMA channel");
 
     this->id = id;
     this->sampleRate = sampleRate;
@@ -114,8 +116,11 @@ SAMD21PDM::SAMD21PDM(ZPin &sd, ZPin &sck, int sampleRate, uint16_t id) : output(
     connect_gclk_to_peripheral(CLK_GEN_48MHZ, I2S_GCLK_ID_0);
 
     // Configure a DMA channel
-    dma->configure(I2S_DMAC_ID_RX_1, DmaBeatSize::BeatWord, &I2S->DATAREG.reg, NULL);
-    dma->onTransferComplete(this);
+    if (dma)
+    {
+        dma->configure(I2S_DMAC_ID_RX_1, DmaBeatSize::BeatWord, &I2S->DATAREG.reg, NULL);
+        dma->onTransferComplete(dma_member_handler<SAMD21PDM>, this);
+    }
 
     // Configure for DMA enabled, single channel PDM input.
     int clockDivisor = 1;
@@ -290,8 +295,8 @@ void SAMD21PDM::dmaTransferComplete(DmaCode c)
  */
 void SAMD21PDM::enable()
 {
-    // If we're already running, nothing to do.
-    if (enabled)
+    // If we're already running, or have no DMA channel to run with, nothing to do.
+    if (enabled || dma == NULL)
         return;
 
     // DMESG("enable");
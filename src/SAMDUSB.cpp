@@ -23,15 +23,71 @@ DEALINGS IN THE SOFTWARE.
 */
 
 #include "CodalUSB.h"
+#include "SAMDUSB.h"
 
 #if CONFIG_ENABLED(DEVICE_USB)
 #include "sam.h"
 #include "CodalDmesg.h"
+#include "codal_target_hal.h"
+#include "CodalFiber.h"
+#include "Event.h"
+#include "Timer.h"
 // #include "system_interrupt.h"
 
 static UsbDeviceDescriptor *usb_endpoints;
 static uint8_t usb_num_endpoints;
 
+// notify event codes used to wake fibers waiting on IN transfers, allocated on first use.
+static uint16_t *usb_in_events;
+
+// status of a queued write that has not completed yet.
+#define USB_WRITE_PENDING 1
+
+// an IN transfer queued on an endpoint, see usb_write_async().
+struct UsbWriteRequest
+{
+    UsbWriteRequest *next;
+    UsbEndpointIn *ep;
+    const uint8_t *ptr;
+    int remaining;
+    int chunk; // bytes handed to the hardware by the last usb_start_write()
+    bool zlp;  // a zero length packet is still to be sent after the data
+    bool pooled; // taken from the endpoint's pool by usb_write_async(), and returned on completion
+    bool inUse;  // for pool entries, whether the entry is taken
+    volatile int status;
+    UsbWriteCallback cb;
+    void *arg;
+};
+
+// per endpoint queue of IN transfers; the head is the one on the wire.
+static UsbWriteRequest **usb_write_queues;
+
+// USB_ASYNC_WRITES_PER_EP requests for each endpoint, for usb_write_async() and for
+// UsbEndpointIn::write() calls that sleep.
+static UsbWriteRequest *usb_write_pool;
+
+// BYTE_COUNT is 14 bits wide; this is the largest multiple of the packet size that fits.
+#define USB_MAX_MULTI_PACKET_SIZE 16320
+
+// state of a direct (zero-copy) read on an OUT endpoint, see usb_read_direct().
+struct UsbDirectRead
+{
+    UsbEndpointOut *ep; // NULL when no direct read is pending
+    UsbReadCallback cb;
+    void *arg;
+    bool irqEnabled; // whether TRCPT0 was enabled before the read was armed
+};
+
+static UsbDirectRead *usb_direct_reads;
+
+#if CONFIG_ENABLED(DEVICE_USB_STATS)
+static UsbEndpointStats *usb_ep_stats;
+static UsbStats usb_irq_stats;
+#define USB_STATS_ADD(ep, field, n) (usb_ep_stats[ep].field += (n))
+#else
+#define USB_STATS_ADD(ep, field, n) ((void)0)
+#endif
+
 #define NVM_USB_PAD_TRANSN_POS 45
 #define NVM_USB_PAD_TRANSN_SIZE 5
 #define NVM_USB_PAD_TRANSP_POS 50
@@ -50,6 +106,18 @@ void usb_configure(uint8_t numEndpoints)
     usb_num_endpoints = numEndpoints;
     usb_endpoints = new UsbDeviceDescriptor[usb_num_endpoints];
     memset(usb_endpoints, 0, usb_num_endpoints * sizeof(UsbDeviceDescriptor));
+    usb_in_events = new uint16_t[usb_num_endpoints];
+    memset(usb_in_events, 0, usb_num_endpoints * sizeof(uint16_t));
+    usb_write_queues = new UsbWriteRequest *[usb_num_endpoints];
+    memset(usb_write_queues, 0, usb_num_endpoints * sizeof(UsbWriteRequest *));
+    usb_write_pool = new UsbWriteRequest[usb_num_endpoints * USB_ASYNC_WRITES_PER_EP];
+    memset(usb_write_pool, 0, usb_num_endpoints * USB_ASYNC_WRITES_PER_EP * sizeof(UsbWriteRequest));
+    usb_direct_reads = new UsbDirectRead[usb_num_endpoints];
+    memset(usb_direct_reads, 0, usb_num_endpoints * sizeof(UsbDirectRead));
+#if CONFIG_ENABLED(DEVICE_USB_STATS)
+    usb_ep_stats = new UsbEndpointStats[usb_num_endpoints];
+    usb_stats_reset();
+#endif
 
     uint32_t pad_transn, pad_transp, pad_trim;
 
@@ -153,7 +221,355 @@ void usb_configure(uint8_t numEndpoints)
     USB->HOST.CTRLA.bit.ENABLE = true;
 }
 
-extern "C" void USB_Handler(void)
+/**
+ * Determines if the USB DMA can't send the given data in place: it only reads word aligned RAM.
+ */
+static bool usb_needs_bounce(const void *p)
+{
+    return (uint32_t)p < 0x20000000 || ((uint32_t)p & 3);
+}
+
+/**
+ * Hands the next part of the request at the head of an endpoint's queue to bank 1.
+ *
+ * Aligned data in RAM is sent in place as a multi-packet transfer, anything else is
+ * copied into the endpoint's own packet buffer a packet at a time.
+ *
+ * Dual-bank (ping-pong) mode isn't used. It would make bank 0 a second IN bank, taking it
+ * from the OUT endpoint of the same number, and UsbEndpointIn is set up without knowing
+ * whether that OUT endpoint is in use. A multi-packet transfer already keeps the bus busy
+ * for up to 16320 bytes, so all it would save is re-arming between transfers.
+ */
+static void usb_start_write(uint8_t ep)
+{
+    UsbWriteRequest *req = usb_write_queues[ep];
+    UsbDeviceDescriptor *epdesc = (UsbDeviceDescriptor *)usb_endpoints + ep;
+    int epSize = 1 << (epdesc->DeviceDescBank[1].PCKSIZE.bit.SIZE + 3);
+    int chunk = req->remaining;
+
+    if (chunk > 0)
+    {
+        if (usb_needs_bounce(req->ptr))
+        {
+            if (chunk > epSize)
+                chunk = epSize;
+            memcpy(req->ep->buf, req->ptr, chunk);
+            epdesc->DeviceDescBank[1].ADDR.reg = (uint32_t)req->ep->buf;
+        }
+        else
+        {
+            if (chunk > USB_MAX_MULTI_PACKET_SIZE)
+                chunk = USB_MAX_MULTI_PACKET_SIZE;
+            epdesc->DeviceDescBank[1].ADDR.reg = (uint32_t)req->ptr;
+        }
+    }
+
+    req->chunk = chunk;
+
+#if CONFIG_ENABLED(DEVICE_USB_STATS)
+    // the host has been asking for data we didn't have ready yet.
+    if (USB->DEVICE.DeviceEndpoint[ep].EPINTFLAG.reg & USB_DEVICE_EPINTFLAG_TRFAIL1)
+    {
+        USB->DEVICE.DeviceEndpoint[ep].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRFAIL1;
+        USB_STATS_ADD(ep, inNaks, 1);
+    }
+#endif
+
+    epdesc->DeviceDescBank[1].PCKSIZE.bit.BYTE_COUNT = chunk;
+    epdesc->DeviceDescBank[1].PCKSIZE.bit.MULTI_PACKET_SIZE = 0;
+    /* Clear the transfer complete flag  */
+    USB->DEVICE.DeviceEndpoint[ep].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRCPT1;
+
+    // the control endpoint is only ever written from the USB interrupt, and is polled.
+    if (ep != 0)
+        USB->DEVICE.DeviceEndpoint[ep].EPINTENSET.reg = USB_DEVICE_EPINTENSET_TRCPT1;
+
+    /* Set the bank as ready */
+    USB->DEVICE.DeviceEndpoint[ep].EPSTATUSSET.reg = USB_DEVICE_EPSTATUSSET_BK1RDY;
+}
+
+/**
+ * Reports the outcome of a write, and returns it to the pool if it came from usb_write_async().
+ */
+static void usb_finish_write(UsbWriteRequest *req, int status)
+{
+    if (req->cb)
+        req->cb(req->ep, req->arg, status);
+
+    if (req->pooled)
+        req->inUse = false;
+    else
+        req->status = status;
+}
+
+/**
+ * Appends a write to an endpoint's queue, starting it straight away if the endpoint is idle.
+ */
+static void usb_queue_write(uint8_t ep, UsbWriteRequest *req)
+{
+    req->next = NULL;
+    req->status = USB_WRITE_PENDING;
+
+    target_disable_irq();
+
+    UsbWriteRequest **p = &usb_write_queues[ep];
+    while (*p)
+        p = &(*p)->next;
+    *p = req;
+
+    if (usb_write_queues[ep] == req)
+        usb_start_write(ep);
+
+    target_enable_irq();
+}
+
+/**
+ * Moves an endpoint's queue along once the hardware has finished with the current transfer.
+ * Called from the USB interrupt, or with interrupts disabled.
+ */
+static void usb_service_write(uint8_t ep)
+{
+    UsbWriteRequest *req = usb_write_queues[ep];
+
+    if (req == NULL || !(USB->DEVICE.DeviceEndpoint[ep].EPINTFLAG.reg & USB_DEVICE_EPINTFLAG_TRCPT1))
+        return;
+
+    USB->DEVICE.DeviceEndpoint[ep].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRCPT1;
+
+#if CONFIG_ENABLED(DEVICE_USB_STATS)
+    int epSize = 1 << (usb_endpoints[ep].DeviceDescBank[1].PCKSIZE.bit.SIZE + 3);
+    USB_STATS_ADD(ep, inPackets, req->chunk ? (req->chunk + epSize - 1) / epSize : 1);
+    USB_STATS_ADD(ep, inBytes, req->chunk);
+#endif
+
+    req->ptr += req->chunk;
+    req->remaining -= req->chunk;
+
+    if (req->remaining > 0 || req->zlp)
+    {
+        if (req->remaining == 0)
+            req->zlp = false;
+
+        usb_start_write(ep);
+        return;
+    }
+
+    // start the next transfer before running the callback, which may well queue another.
+    usb_write_queues[ep] = req->next;
+
+    if (usb_write_queues[ep])
+        usb_start_write(ep);
+    else if (ep != 0)
+        USB->DEVICE.DeviceEndpoint[ep].EPINTENCLR.reg = USB_DEVICE_EPINTENCLR_TRCPT1;
+
+    usb_finish_write(req, DEVICE_OK);
+}
+
+/**
+ * Drops every write queued on an endpoint, reporting them as cancelled.
+ */
+static void usb_cancel_writes(uint8_t ep)
+{
+    target_disable_irq();
+
+    UsbWriteRequest *req = usb_write_queues[ep];
+    usb_write_queues[ep] = NULL;
+
+    if (ep != 0)
+        USB->DEVICE.DeviceEndpoint[ep].EPINTENCLR.reg = USB_DEVICE_EPINTENCLR_TRCPT1;
+
+    while (req)
+    {
+        UsbWriteRequest *next = req->next;
+        usb_finish_write(req, DEVICE_CANCELLED);
+        req = next;
+    }
+
+    target_enable_irq();
+}
+
+/**
+ * Takes a free request from the endpoint's pool, or returns NULL if they are all in use.
+ */
+static UsbWriteRequest *usb_alloc_write(uint8_t ep)
+{
+    UsbWriteRequest *pool = &usb_write_pool[ep * USB_ASYNC_WRITES_PER_EP];
+    UsbWriteRequest *req = NULL;
+
+    target_disable_irq();
+    for (int i = 0; i < USB_ASYNC_WRITES_PER_EP; i++)
+    {
+        if (!pool[i].inUse)
+        {
+            req = &pool[i];
+            req->inUse = true;
+            break;
+        }
+    }
+    target_enable_irq();
+
+    return req;
+}
+
+int usb_write_async(UsbEndpointIn *in, const void *src, int len, UsbWriteCallback cb, void *arg)
+{
+    usb_assert(in != NULL);
+
+    if (in->ep == 0 || len < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    UsbDeviceDescriptor *epdesc = (UsbDeviceDescriptor *)usb_endpoints + in->ep;
+    int epSize = 1 << (epdesc->DeviceDescBank[1].PCKSIZE.bit.SIZE + 3);
+
+    UsbWriteRequest *req = usb_alloc_write(in->ep);
+
+    if (req == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    req->ep = in;
+    req->ptr = (const uint8_t *)src;
+    req->remaining = len;
+    req->zlp = !(in->flags & USB_EP_FLAG_NO_AUTO_ZLP) && len && (len & (epSize - 1)) == 0;
+    req->pooled = true;
+    req->cb = cb;
+    req->arg = arg;
+
+    usb_queue_write(in->ep, req);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Completion callback for blocking writes; wakes the waiting fibers to check their request.
+ */
+static void usb_write_notify(UsbEndpointIn *ep, void *arg, int status)
+{
+    codal::Event(DEVICE_ID_NOTIFY, (uint16_t)(uint32_t)arg);
+}
+
+/**
+ * Completes the direct read pending on the given endpoint.
+ *
+ * @param ep the endpoint index.
+ * @param len the number of bytes received, or an error code.
+ * @param restart if true, and the callback doesn't arm another direct read, the endpoint
+ *        goes back to receiving into its own buffer.
+ */
+static void usb_finish_read(uint8_t ep, int len, bool restart)
+{
+    UsbDirectRead *r = &usb_direct_reads[ep];
+    UsbEndpointOut *out = r->ep;
+
+    if (out == NULL)
+        return;
+
+    r->ep = NULL;
+
+    if (!r->irqEnabled)
+        USB->DEVICE.DeviceEndpoint[ep].EPINTENCLR.reg = USB_DEVICE_EPINTENCLR_TRCPT0;
+
+    r->cb(out, r->arg, len);
+
+    if (restart && r->ep == NULL)
+        out->startRead();
+}
+
+/**
+ * Hands any direct reads the hardware has finished over to their callbacks.
+ */
+static void usb_complete_reads()
+{
+    for (int ep = 1; ep < usb_num_endpoints; ep++)
+    {
+        if (usb_direct_reads[ep].ep &&
+            (USB->DEVICE.DeviceEndpoint[ep].EPINTFLAG.reg & USB_DEVICE_EPINTFLAG_TRCPT0))
+        {
+            int len = usb_endpoints[ep].DeviceDescBank[0].PCKSIZE.bit.BYTE_COUNT;
+            USB->DEVICE.DeviceEndpoint[ep].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRCPT0;
+#if CONFIG_ENABLED(DEVICE_USB_STATS)
+            int epSize = 1 << (usb_endpoints[ep].DeviceDescBank[0].PCKSIZE.bit.SIZE + 3);
+            USB_STATS_ADD(ep, outPackets, len ? (len + epSize - 1) / epSize : 1);
+            USB_STATS_ADD(ep, outBytes, len);
+#endif
+            usb_finish_read(ep, len, true);
+        }
+    }
+}
+
+int usb_read_direct(UsbEndpointOut *out, void *dst, int len, UsbReadCallback cb, void *arg)
+{
+    usb_assert(out != NULL);
+
+    uint8_t ep = out->ep;
+    uint8_t getSP = 0;
+
+    // the USB DMA writes whole words, into RAM only, and not into the stack, which
+    // belongs to whichever fiber happens to be running when the data arrives.
+    if (ep == 0 || cb == NULL || len <= 0 || len > USB_MAX_DIRECT_READ || (len & 63) ||
+        ((uint32_t)dst & 3) || (uint32_t)dst < 0x20000000 || (uint8_t *)dst >= &getSP)
+        return DEVICE_INVALID_PARAMETER;
+
+    UsbDeviceEndpoint *dep = &USB->DEVICE.DeviceEndpoint[ep];
+    UsbDeviceDescriptor *epdesc = (UsbDeviceDescriptor *)usb_endpoints + ep;
+    UsbDirectRead *r = &usb_direct_reads[ep];
+
+    target_disable_irq();
+
+    if (r->ep != NULL)
+    {
+        target_enable_irq();
+        return DEVICE_BUSY;
+    }
+
+    // NAK the host while the bank is pointed somewhere else.
+    dep->EPSTATUSSET.reg = USB_DEVICE_EPSTATUSSET_BK0RDY;
+
+    // a packet already sitting in the endpoint buffer has to be read() first.
+    if (dep->EPINTFLAG.reg & USB_DEVICE_EPINTFLAG_TRCPT0)
+    {
+        target_enable_irq();
+        return DEVICE_BUSY;
+    }
+
+    r->ep = out;
+    r->cb = cb;
+    r->arg = arg;
+    r->irqEnabled = (dep->EPINTENSET.reg & USB_DEVICE_EPINTENSET_TRCPT0) != 0;
+
+    epdesc->DeviceDescBank[0].ADDR.reg = (uint32_t)dst;
+    epdesc->DeviceDescBank[0].PCKSIZE.bit.BYTE_COUNT = 0;
+    epdesc->DeviceDescBank[0].PCKSIZE.bit.MULTI_PACKET_SIZE = len;
+
+    dep->EPINTENSET.reg = USB_DEVICE_EPINTENSET_TRCPT0;
+    dep->EPSTATUSCLR.reg = USB_DEVICE_EPSTATUSCLR_BK0RDY;
+
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+int usb_read_direct_cancel(UsbEndpointOut *out)
+{
+    usb_assert(out != NULL);
+
+    target_disable_irq();
+
+    if (usb_direct_reads[out->ep].ep == NULL)
+    {
+        target_enable_irq();
+        return DEVICE_INVALID_PARAMETER;
+    }
+
+    USB->DEVICE.DeviceEndpoint[out->ep].EPSTATUSSET.reg = USB_DEVICE_EPSTATUSSET_BK0RDY;
+    USB->DEVICE.DeviceEndpoint[out->ep].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRCPT0;
+    usb_finish_read(out->ep, DEVICE_CANCELLED, true);
+
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+static void usb_handle_interrupt()
 {
     CodalUSB *cusb = CodalUSB::usbInstance;
 
@@ -170,10 +586,22 @@ extern "C" void USB_Handler(void)
         /* Set Device address as 0 */
         USB->DEVICE.DADD.reg = USB_DEVICE_DADD_ADDEN | 0;
 
+        // nothing pending will complete now, so let the owners know.
+        for (int ep = 0; ep < usb_num_endpoints; ep++)
+        {
+            usb_cancel_writes(ep);
+            usb_finish_read(ep, DEVICE_CANCELLED, false);
+        }
+
         cusb->initEndpoints();
         return;
     }
 
+    for (int ep = 1; ep < usb_num_endpoints; ep++)
+        usb_service_write(ep);
+
+    usb_complete_reads();
+
     if (USB->DEVICE.DeviceEndpoint[0].EPINTFLAG.reg & USB_DEVICE_EPINTFLAG_RXSTP)
     {
         // clear the flag
@@ -188,6 +616,69 @@ extern "C" void USB_Handler(void)
     cusb->interruptHandler();
 }
 
+extern "C" void USB_Handler(void)
+{
+#if CONFIG_ENABLED(DEVICE_USB_STATS)
+    uint32_t start = (uint32_t)codal::system_timer_current_time_us();
+    usb_handle_interrupt();
+    uint32_t elapsed = (uint32_t)codal::system_timer_current_time_us() - start;
+
+    usb_irq_stats.interrupts++;
+    usb_irq_stats.interruptTime += elapsed;
+    if (elapsed > usb_irq_stats.maxInterruptTime)
+        usb_irq_stats.maxInterruptTime = elapsed;
+#else
+    usb_handle_interrupt();
+#endif
+}
+
+#if CONFIG_ENABLED(DEVICE_USB_STATS)
+const UsbEndpointStats *usb_endpoint_stats(uint8_t ep)
+{
+    if (usb_ep_stats == NULL || ep >= usb_num_endpoints)
+        return NULL;
+
+    return &usb_ep_stats[ep];
+}
+
+const UsbStats *usb_stats()
+{
+    return &usb_irq_stats;
+}
+
+void usb_stats_reset()
+{
+    target_disable_irq();
+    if (usb_ep_stats)
+        memset(usb_ep_stats, 0, usb_num_endpoints * sizeof(UsbEndpointStats));
+    memset(&usb_irq_stats, 0, sizeof(usb_irq_stats));
+    target_enable_irq();
+}
+
+void usb_stats_dump()
+{
+    // nothing has been counted before usb_configure().
+    if (usb_ep_stats == NULL)
+        return;
+
+    DMESG("USB irq: n=%d total=%dus max=%dus", usb_irq_stats.interrupts,
+          usb_irq_stats.interruptTime, usb_irq_stats.maxInterruptTime);
+
+    for (int ep = 0; ep < usb_num_endpoints; ep++)
+    {
+        UsbEndpointStats *st = &usb_ep_stats[ep];
+
+        if (st->inPackets == 0 && st->outPackets == 0 && st->inNaks == 0 && st->outNaks == 0 &&
+            st->stalls == 0)
+            continue;
+
+        DMESG("USB ep%d: in=%d/%dB nak=%d out=%d/%dB nak=%d stall=%d spin=%dus", ep,
+              st->inPackets, st->inBytes, st->inNaks, st->outPackets, st->outBytes, st->outNaks,
+              st->stalls, st->spinTime);
+    }
+}
+#endif
+
 #ifdef SAMD51
 extern "C" void USB_0_Handler(void)
 {
@@ -241,6 +732,7 @@ int UsbEndpointIn::reset()
     DMESG("reset IN %d", ep);
     USB->DEVICE.DeviceEndpoint[ep].EPSTATUSCLR.reg = USB_DEVICE_EPSTATUSCLR_BK1RDY;
     USB->DEVICE.DeviceEndpoint[ep].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRCPT1;
+    usb_cancel_writes(ep);
     wLength = 0;
     return DEVICE_OK;
 }
@@ -248,7 +740,9 @@ int UsbEndpointIn::reset()
 int UsbEndpointIn::stall()
 {
     DMESG("stall IN %d", ep);
+    USB_STATS_ADD(ep, stalls, 1);
     USB->DEVICE.DeviceEndpoint[ep].EPSTATUSSET.reg = USB_DEVICE_EPSTATUSSET_STALLRQ1;
+    usb_cancel_writes(ep);
     wLength = 0;
     return DEVICE_OK;
 }
@@ -275,12 +769,19 @@ int UsbEndpointOut::reset()
     DMESG("reset OUT %d", ep);
     USB->DEVICE.DeviceEndpoint[ep].EPSTATUSSET.reg = USB_DEVICE_EPSTATUSSET_BK0RDY;
     USB->DEVICE.DeviceEndpoint[ep].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRCPT0;
+    if (usb_direct_reads[ep].ep)
+    {
+        usb_finish_read(ep, DEVICE_CANCELLED, false);
+        usb_endpoints[ep].DeviceDescBank[0].ADDR.reg = (uint32_t)buf;
+        usb_endpoints[ep].DeviceDescBank[0].PCKSIZE.bit.MULTI_PACKET_SIZE = 0;
+    }
     return DEVICE_OK;
 }
 
 int UsbEndpointOut::stall()
 {
     DMESG("stall OUT %d", ep);
+    USB_STATS_ADD(ep, stalls, 1);
     USB->DEVICE.DeviceEndpoint[ep].EPSTATUSSET.reg = USB_DEVICE_EPSTATUSSET_STALLRQ0;
     return DEVICE_OK;
 }
@@ -354,6 +855,16 @@ void UsbEndpointOut::startRead()
     epdesc->DeviceDescBank[0].ADDR.reg = (uint32_t)buf;
     epdesc->DeviceDescBank[0].PCKSIZE.bit.BYTE_COUNT = 0;
     epdesc->DeviceDescBank[0].PCKSIZE.bit.MULTI_PACKET_SIZE = 0;
+
+#if CONFIG_ENABLED(DEVICE_USB_STATS)
+    // the host has been trying to send while the bank was still full.
+    if (USB->DEVICE.DeviceEndpoint[ep].EPINTFLAG.reg & USB_DEVICE_EPINTFLAG_TRFAIL0)
+    {
+        USB->DEVICE.DeviceEndpoint[ep].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRFAIL0;
+        USB_STATS_ADD(ep, outNaks, 1);
+    }
+#endif
+
     /* Start the reception by clearing the bank 0 ready bit */
     USB->DEVICE.DeviceEndpoint[ep].EPSTATUSCLR.reg = USB_DEVICE_EPSTATUSSET_BK0RDY;
 }
@@ -364,6 +875,10 @@ int UsbEndpointOut::read(void *dst, int maxlen)
 
     usb_assert(this != NULL);
 
+    // the bank belongs to usb_read_direct() until its callback has run.
+    if (usb_direct_reads[ep].ep)
+        return 0;
+
     uint32_t flag = ep == 0 ? USB_DEVICE_EPINTFLAG_RXSTP : USB_DEVICE_EPINTFLAG_TRCPT0;
 
     /* Check for Transfer Complete 0 flag */
@@ -372,6 +887,8 @@ int UsbEndpointOut::read(void *dst, int maxlen)
         packetSize = usb_endpoints[ep].DeviceDescBank[0].PCKSIZE.bit.BYTE_COUNT;
 
         // DMESG("USBRead(%d) => %d bytes", ep, packetSize);
+        USB_STATS_ADD(ep, outPackets, 1);
+        USB_STATS_ADD(ep, outBytes, packetSize);
 
         // Note that we shall discard any excessive data
         if (packetSize > maxlen)
@@ -388,25 +905,8 @@ int UsbEndpointOut::read(void *dst, int maxlen)
     return packetSize;
 }
 
-static void writeEP(UsbDeviceDescriptor *epdesc, uint8_t ep, int len)
-{
-    epdesc->DeviceDescBank[1].PCKSIZE.bit.BYTE_COUNT = len;
-    epdesc->DeviceDescBank[1].PCKSIZE.bit.MULTI_PACKET_SIZE = 0;
-    /* Clear the transfer complete flag  */
-    USB->DEVICE.DeviceEndpoint[ep].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRCPT1;
-    /* Set the bank as ready */
-    USB->DEVICE.DeviceEndpoint[ep].EPSTATUSSET.reg = USB_DEVICE_EPSTATUSSET_BK1RDY;
-
-    /* Wait for transfer to complete */
-    while (!(USB->DEVICE.DeviceEndpoint[ep].EPINTFLAG.reg & USB_DEVICE_EPINTFLAG_TRCPT1))
-    {
-    }
-}
-
 int UsbEndpointIn::write(const void *src, int len)
 {
-    uint32_t data_address;
-
     // this happens when someone tries to write before USB is initialized
     usb_assert(this != NULL);
 
@@ -427,31 +927,79 @@ int UsbEndpointIn::write(const void *src, int len)
         wLength = 0;
     }
 
-    if (len > epSize)
+    // Outside of interrupt context we sleep until our request has gone, rather than spin.
+    // The control endpoint is serviced from the USB interrupt, so it always polls. Data on
+    // the stack is sent in place too, and fibers swap their stacks in and out of the same
+    // memory, so that has to be sent before anyone else runs.
+    uint8_t getSP = 0;
+    bool sleep = ep != 0 && __get_IPSR() == 0 && codal::fiber_scheduler_running() &&
+                 (const uint8_t *)src < &getSP;
+
+    // For the same reason a sleeping writer's request can't live on its stack either, so it
+    // borrows one from the endpoint's pool; if they are all taken we spin instead.
+    UsbWriteRequest local;
+    UsbWriteRequest *req = sleep ? usb_alloc_write(ep) : NULL;
+
+    if (req == NULL)
     {
-        data_address = (uint32_t)src;
-        // data must be in RAM!
-        usb_assert(data_address >= 0x20000000);
+        sleep = false;
+        req = &local;
     }
-    else
+
+    req->ep = this;
+    req->ptr = (const uint8_t *)src;
+    req->remaining = len;
+    // It seems AUTO_ZLP has issues with 64 byte control endpoints.
+    // We just send ZLP manually if needed.
+    req->zlp = zlp && len && (len & (epSize - 1)) == 0;
+    // completion stores the status rather than returning the entry; we release it below.
+    req->pooled = false;
+    req->cb = NULL;
+    req->arg = NULL;
+
+    if (sleep)
     {
-        /* Copy to local buffer */
-        memcpy(buf, src, len);
-        data_address = (uint32_t)buf;
-    }
+        if (usb_in_events[ep] == 0)
+            usb_in_events[ep] = codal::allocateNotifyEvent();
 
-    epdesc->DeviceDescBank[1].ADDR.reg = data_address;
+        req->cb = usb_write_notify;
+        req->arg = (void *)(uint32_t)usb_in_events[ep];
+    }
 
-    writeEP(epdesc, ep, len);
+    usb_queue_write(ep, req);
 
-    // It seems AUTO_ZLP has issues with 64 byte control endpoints.
-    // We just send ZLP manually if needed.
-    if (zlp && len && (len & (epSize - 1)) == 0)
+    if (sleep)
+    {
+        target_disable_irq();
+        while (req->status == USB_WRITE_PENDING)
+        {
+            codal::fiber_wake_on_event(DEVICE_ID_NOTIFY, usb_in_events[ep]);
+            target_enable_irq();
+            codal::schedule();
+            target_disable_irq();
+        }
+        target_enable_irq();
+    }
+    else
     {
-        writeEP(epdesc, ep, 0);
+#if CONFIG_ENABLED(DEVICE_USB_STATS)
+        uint32_t start = (uint32_t)codal::system_timer_current_time_us();
+#endif
+        while (req->status == USB_WRITE_PENDING)
+        {
+            target_disable_irq();
+            usb_service_write(ep);
+            target_enable_irq();
+        }
+#if CONFIG_ENABLED(DEVICE_USB_STATS)
+        USB_STATS_ADD(ep, spinTime, (uint32_t)codal::system_timer_current_time_us() - start);
+#endif
     }
 
-    return DEVICE_OK;
+    int status = req->status;
+    req->inUse = false;
+
+    return status;
 }
 
 #endif
@@ -0,0 +1,229 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "ZPWMGroup.h"
+#include "codal_target_hal.h"
+#include "pinmap.h"
+#include "pwmout_api.h"
+
+extern "C"
+{
+#include "clocks.h"
+#include "timers.h"
+}
+
+#undef ENABLE
+
+using namespace codal;
+
+// The number of dead-time generators of each TCC. Generator x drives WO[x], and WO[x + 4] as
+// its complement.
+#ifdef SAMD21
+static const uint8_t tcc_dti_num[] = { 4, 0, 0 };
+static const uint8_t tcc_sizes[] = { TCC0_SIZE, TCC1_SIZE, TCC2_SIZE };
+#else
+static const uint8_t tcc_dti_num[] = { 4, 4, 0, 0, 0 };
+static const uint8_t tcc_sizes[] = { TCC0_SIZE, TCC1_SIZE, TCC2_SIZE, TCC3_SIZE, TCC4_SIZE };
+#endif
+
+/**
+ * Finds the entry of the pin's timer table that drives it from the given TCC.
+ *
+ * @return the index of the entry, which is also its pinmux offset from MUX_E, or -1.
+ */
+static int find_tcc_output(const mcu_pin_obj_t *pin, int tccIndex)
+{
+    for (int i = 0; i < NUM_TIMERS_PER_PIN; i++)
+        if (!pin->timer[i].is_tc && pin->timer[i].index == tccIndex)
+            return i;
+
+    return -1;
+}
+
+ZPWMGroup::ZPWMGroup(ZPin **pins, int count, int period)
+{
+    CODAL_ASSERT(count > 0 && count <= ZPWM_GROUP_MAX_PINS && period > 0 && period <= 1000000, DEVICE_INVALID_PARAMETER);
+
+    this->count = count;
+    for (int i = 0; i < count; i++)
+        this->pins[i] = pins[i];
+    this->complements = 0;
+    this->generators = 0;
+
+    const mcu_pin_obj_t *mcuPins[ZPWM_GROUP_MAX_PINS];
+    for (int i = 0; i < count; i++)
+    {
+        mcuPins[i] = find_mcu_pin(pins[i]->name);
+        CODAL_ASSERT(mcuPins[i] != NULL, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+    }
+
+    // take the first free TCC that reaches every pin.
+    tccIndex = -1;
+    for (int t = 0; t < TCC_INST_NUM && tccIndex < 0; t++)
+    {
+        bool reachable = true;
+        for (int i = 0; i < count && reachable; i++)
+            reachable = find_tcc_output(mcuPins[i], t) >= 0;
+
+        if (reachable && pwmout_claim_tcc(t) == 0)
+            tccIndex = t;
+    }
+
+    CODAL_ASSERT(tccIndex >= 0, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+
+    tcc = tcc_insts[tccIndex];
+
+    // a pin on the upper output of a dead-time generator whose lower output is also in the
+    // group becomes the complement of that pin.
+    uint8_t outputs = 0;
+    for (int i = 0; i < count; i++)
+        outputs |= 1 << mcuPins[i]->timer[find_tcc_output(mcuPins[i], tccIndex)].wave_output;
+
+    uint32_t wexctrl = 0;
+    for (int i = 0; i < count; i++)
+    {
+        const pin_timer_t *t = &mcuPins[i]->timer[find_tcc_output(mcuPins[i], tccIndex)];
+        int lower = t->wave_output - 4;
+
+        channels[i] = t->wave_output % tcc_cc_num[tccIndex];
+
+        if (lower >= 0 && lower < tcc_dti_num[tccIndex] && (outputs & (1 << lower)))
+        {
+            complements |= 1 << i;
+            generators |= 1 << lower;
+            wexctrl |= TCC_WEXCTRL_DTIEN0 << lower;
+        }
+    }
+
+    // the highest resolution that fits the period, running from the CPU clock as pwmout does.
+    uint32_t system_clock = CODAL_CPU_MHZ * 1000000;
+    for (divisor = 0; divisor < 8; divisor++)
+    {
+        top = (uint32_t)((uint64_t)(system_clock / prescaler[divisor]) * period / 1000000) - 1;
+        if (top < (1u << tcc_sizes[tccIndex]))
+            break;
+    }
+
+    // even DIV1024 can't count out a period this long on this TCC.
+    CODAL_ASSERT(divisor < 8, DEVICE_INVALID_PARAMETER);
+
+    turn_on_clocks(false, tccIndex, 0);
+
+    tcc_set_enable(tcc, false);
+    tcc->CTRLA.bit.PRESCALER = divisor;
+    tcc->PER.bit.PER = top;
+    tcc->WAVE.bit.WAVEGEN = TCC_WAVE_WAVEGEN_NPWM_Val;
+    tcc->WEXCTRL.reg = wexctrl;
+    for (int i = 0; i < count; i++)
+        tcc->CC[channels[i]].reg = 0;
+    tcc_set_enable(tcc, true);
+
+    for (int i = 0; i < count; i++)
+        pins[i]->_setMux(MUX_E + find_tcc_output(mcuPins[i], tccIndex));
+}
+
+uint32_t ZPWMGroup::getTop()
+{
+    return top;
+}
+
+/**
+ * Holds back the buffered compare values until unlock(), so they are loaded together.
+ */
+void ZPWMGroup::lock()
+{
+    tcc->CTRLBSET.reg = TCC_CTRLBSET_LUPD;
+    while (tcc->SYNCBUSY.bit.CTRLB);
+}
+
+/**
+ * Lets the buffered compare values load at the start of the next period.
+ */
+void ZPWMGroup::unlock()
+{
+    tcc->CTRLBCLR.reg = TCC_CTRLBCLR_LUPD;
+    while (tcc->SYNCBUSY.bit.CTRLB);
+}
+
+void ZPWMGroup::setCompare(int channel, uint32_t value)
+{
+    // wait for a previous value to be written.
+#ifdef SAMD21
+    while ((tcc->SYNCBUSY.vec.CCB & (1 << channel)) != 0);
+    tcc->CCB[channel].reg = value;
+#endif
+#ifdef SAMD51
+    while ((tcc->SYNCBUSY.vec.CC & (1 << channel)) != 0);
+    tcc->CCBUF[channel].reg = value;
+#endif
+}
+
+int ZPWMGroup::write(const uint32_t *values)
+{
+    for (int i = 0; i < count; i++)
+        if (!(complements & (1 << i)) && values[i] > top)
+            return DEVICE_INVALID_PARAMETER;
+
+    lock();
+
+    for (int i = 0; i < count; i++)
+        if (!(complements & (1 << i)))
+            setCompare(channels[i], values[i]);
+
+    unlock();
+
+    return DEVICE_OK;
+}
+
+int ZPWMGroup::setDeadTime(int low, int high)
+{
+    if (generators == 0)
+        return DEVICE_NOT_SUPPORTED;
+
+    // the dead-time counters run from the undivided clock, not the prescaled one.
+    int scale = prescaler[divisor];
+    if (low < 0 || low > 255 / scale || high < 0 || high > 255 / scale)
+        return DEVICE_INVALID_PARAMETER;
+
+    low *= scale;
+    high *= scale;
+
+    // WEXCTRL can only be written while the TCC is stopped.
+    tcc_set_enable(tcc, false);
+    tcc->WEXCTRL.reg = (tcc->WEXCTRL.reg & ~(TCC_WEXCTRL_DTLS_Msk | TCC_WEXCTRL_DTHS_Msk)) |
+                       TCC_WEXCTRL_DTLS(low) | TCC_WEXCTRL_DTHS(high);
+    tcc_set_enable(tcc, true);
+
+    return DEVICE_OK;
+}
+
+ZPWMGroup::~ZPWMGroup()
+{
+    pwmout_release_tcc(tccIndex);
+
+    // take the pins off the TCC, leaving them as inputs.
+    for (int i = 0; i < count; i++)
+        pins[i]->getDigitalValue();
+}
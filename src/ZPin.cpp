@@ -31,11 +31,13 @@ DEALINGS IN THE SOFTWARE.
 #include "ZPin.h"
 #include "Button.h"
 #include "Timer.h"
+#include "CodalFiber.h"
 #include "codal_target_hal.h"
 #include "codal-core/inc/types/Event.h"
 #include "pinmap.h"
 #include "hal_gpio.h"
-#include "hal_adc_sync.h"
+#include "SAMDADC.h"
+#include "SAMDDMAC.h"
 #include "sam.h"
 #include "CodalDmesg.h"
 #include "hpl_gclk_base.h"
@@ -43,7 +45,6 @@ DEALINGS IN THE SOFTWARE.
 extern "C"
 {
     #include "external_interrupts.h"
-    #include "adc.h"
     #include "clocks.h"
 }
 
@@ -54,16 +55,99 @@ extern "C"
 
 namespace codal
 {
-#ifdef SAMD21
-    static bool eic_enabled = false;
-    static ZPin* instances[EIC_CHANNEL_COUNT] = { NULL };
-#endif
-
 struct ZEventConfig
 {
     CODAL_TIMESTAMP prevPulse;
 };
 
+// Pin mode state lives in fixed pools, so pins can change mode any number of times without
+// touching the heap. Only one pin can use an EIC channel at a time, so event state is kept
+// per channel. Every PWM output takes a whole timer (pwmout_init() asks for a variable
+// frequency), so there can be no more of them than timers.
+static ZEventConfig eventConfigs[EIC_CHANNEL_COUNT];
+
+#ifndef ZPIN_PWM_COUNT
+#define ZPIN_PWM_COUNT (TCC_INST_NUM + TC_INST_NUM)
+#endif
+
+#if ZPIN_EDGE_QUEUE_SIZE & (ZPIN_EDGE_QUEUE_SIZE - 1)
+#error "ZPIN_EDGE_QUEUE_SIZE has to be a power of two"
+#endif
+
+#if ZPIN_EDGE_QUEUE_SIZE > 0
+struct ZPinEdge
+{
+    ZPin *pin;
+    CODAL_TIMESTAMP timestamp;
+    bool level;
+};
+
+// Edges are written by the EIC interrupt and read by one fiber. Each side only moves its own
+// index, and both only ever count up, so records are passed without masking interrupts: the
+// fiber only does that to go to sleep without missing a wake-up. The EIC interrupts all share
+// a priority, so there's only ever one writer.
+static ZPinEdge edgeQueue[ZPIN_EDGE_QUEUE_SIZE];
+static volatile uint32_t edgeHead;      // where the interrupt writes the next edge.
+static volatile uint32_t edgeTail;      // where the fiber reads the next edge.
+static volatile uint32_t edgeOverflows;
+static uint16_t edgeEventCode;          // notify event raised when the queue stops being empty.
+
+static void edge_queue_fiber()
+{
+    while (true)
+    {
+        target_disable_irq();
+        while (edgeTail == edgeHead)
+        {
+            fiber_wake_on_event(DEVICE_ID_NOTIFY, edgeEventCode);
+            target_enable_irq();
+            schedule();
+            target_disable_irq();
+        }
+        target_enable_irq();
+
+        ZPin::processEdgeQueue();
+    }
+}
+#endif
+
+static pwmout_t pwmConfigs[ZPIN_PWM_COUNT];
+static uint32_t pwmConfigsUsed; // one bit per entry of pwmConfigs, up to 32.
+
+static pwmout_t *pwm_config_alloc()
+{
+    pwmout_t *cfg = NULL;
+
+    target_disable_irq();
+    for (int i = 0; i < ZPIN_PWM_COUNT; i++)
+    {
+        if (!(pwmConfigsUsed & (1UL << i)))
+        {
+            pwmConfigsUsed |= 1UL << i;
+            cfg = &pwmConfigs[i];
+            break;
+        }
+    }
+    target_enable_irq();
+
+    return cfg;
+}
+
+static void pwm_config_free(pwmout_t *cfg)
+{
+    target_disable_irq();
+    pwmConfigsUsed &= ~(1UL << (cfg - pwmConfigs));
+    target_enable_irq();
+}
+
+// Analog settings are kept for the life of the pin once given, so are simply handed out in turn.
+#ifndef ZPIN_ANALOG_CONFIG_COUNT
+#define ZPIN_ANALOG_CONFIG_COUNT 8
+#endif
+
+static SAMDADCConfig analogConfigs[ZPIN_ANALOG_CONFIG_COUNT];
+static uint8_t analogConfigsUsed;
+
 inline gpio_pull_mode map(codal::PullMode pinMode)
 {
     switch (pinMode)
@@ -107,31 +191,45 @@ ZPin::ZPin(int id, PinNumber name, PinCapability capability) : codal::Pin(id, na
     this->evCfg = NULL;
     this->btn = NULL;
     this->chan = NULL;
+    this->adcCfg = NULL;
+    this->pwmDma = NULL;
+
+    this->portGroup = &ZPIN_PORT->Group[name / 32];
+    this->portMask = 1UL << (name % 32);
 }
 
 void ZPin::disconnect()
 {
     if (this->status & IO_STATUS_ANALOG_OUT)
     {
+        if (this->pwmDma)
+        {
+            this->pwmDma->abort();
+            delete this->pwmDma;
+        }
+        this->pwmDma = NULL;
+
         if (this->pwmCfg)
-            delete this->pwmCfg;
+        {
+            pwmout_free(this->pwmCfg);
+            pwm_config_free(this->pwmCfg);
+        }
         this->pwmCfg = NULL;
     }
 
     if (this->status & (IO_STATUS_EVENT_ON_EDGE | IO_STATUS_EVENT_PULSE_ON_EDGE | IO_STATUS_INTERRUPT_ON_EDGE))
     {
-        // for the samd21, we simply disable the isr, memory is retained.
-#ifdef SAMD21
-        const mcu_pin_obj_t* pin = samd_peripherals_get_pin(name);
-        configure_eic_channel(pin->extint_channel, 0);
-#else
-        this->chan->disable();
+        EICFactory::getInstance()->free(this->chan->getChannel());
         this->chan = NULL;
-
-        if (this->evCfg)
-            delete this->evCfg;
         this->evCfg = NULL;
-#endif
+    }
+
+    if (this->status & IO_STATUS_ANALOG_IN)
+    {
+        // stop the window monitor, if it's watching us.
+        SAMDADC *adc = NULL;
+        if (SAMDADC::lookup(name, adc) >= 0)
+            adc->stopWindow(this);
     }
 
     if (this->status & IO_STATUS_TOUCH_IN)
@@ -141,6 +239,12 @@ void ZPin::disconnect()
         this->btn = NULL;
     }
 
+#ifdef PORT_IOBUS
+    // continuous sampling is only needed while fastRead() may be used.
+    if (this->status & IO_STATUS_CAN_READ)
+        PORT->Group[name / 32].CTRL.reg &= ~portMask;
+#endif
+
     status = 0;
 }
 
@@ -179,7 +283,10 @@ int ZPin::setDigitalValue(int value)
         status |= IO_STATUS_DIGITAL_OUT;
     }
 
-    gpio_set_pin_level(name, value);
+    if (value)
+        fastSet();
+    else
+        fastClear();
 
     return DEVICE_OK;
 }
@@ -206,10 +313,14 @@ int ZPin::getDigitalValue()
         gpio_set_pin_function(name, GPIO_PIN_FUNCTION_OFF);
         gpio_set_pin_direction(name, GPIO_DIRECTION_IN);
         gpio_set_pin_pull_mode(name, map(pullMode));
+#ifdef PORT_IOBUS
+        // IN only reads correctly over the IOBUS with continuous sampling on.
+        PORT->Group[name / 32].CTRL.reg |= portMask;
+#endif
         status |= IO_STATUS_DIGITAL_IN;
     }
 
-    return gpio_get_pin_level(name);
+    return fastRead();
 }
 
 /**
@@ -246,10 +357,17 @@ int ZPin::setPWM(uint32_t value, uint32_t period)
         disconnect();
         gpio_set_pin_function(name, GPIO_PIN_FUNCTION_OFF);
         gpio_set_pin_direction(name, GPIO_DIRECTION_OUT);
-        this->pwmCfg = new pwmout_t;
+        this->pwmCfg = pwm_config_alloc();
+        if (this->pwmCfg == NULL)
+            return DEVICE_NO_RESOURCES;
+
         r = pwmout_init(this->pwmCfg, name, value, period);
         status = IO_STATUS_ANALOG_OUT;
     } else {
+        // a sequence would overwrite the new value.
+        if (this->pwmDma)
+            this->pwmDma->abort();
+
         r = pwmout_write(this->pwmCfg, value, period);
     }
 
@@ -258,6 +376,116 @@ int ZPin::setPWM(uint32_t value, uint32_t period)
     return DEVICE_OK;
 }
 
+/**
+ * Puts this pin into analog/pwm output mode, driven low, with the timer ready for a sequence.
+ *
+ * @param reg set to the register the sequence is written to.
+ *
+ * @return the value of a full duty cycle, DEVICE_NO_RESOURCES if no timer is free, or
+ *         DEVICE_NOT_SUPPORTED.
+ */
+int ZPin::preparePWMSequence(volatile uint16_t *&reg)
+{
+    if (!(PIN_CAPABILITY_ANALOG & capability))
+        return DEVICE_NOT_SUPPORTED;
+
+    uint32_t period = DEVICE_DEFAULT_PWM_PERIOD;
+    if (status & IO_STATUS_ANALOG_OUT)
+        period = this->pwmCfg->period;
+
+    int r = setPWM(0, period);
+    if (r != DEVICE_OK)
+        return r;
+
+    int top = pwmout_compare_register(this->pwmCfg, &reg);
+    CODAL_ASSERT(top >= 0, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+
+    return top;
+}
+
+/**
+ * Called from the DMA interrupt at the end of each pass through a PWM sequence.
+ */
+static void pwm_sequence_handler(void *arg, DmaCode c)
+{
+    ZPin *pin = (ZPin *)arg;
+
+    if (c == DMA_COMPLETE)
+        Event(pin->id, DEVICE_PIN_EVT_PWM_SEQUENCE_END);
+}
+
+/**
+ * Configures this IO pin as an analog/pwm output (if necessary), and plays a sequence of duty
+ * cycles on it, one per PWM period, written to the timer by DMA.
+ *
+ * @param values the duty cycles, from 0 (always low) to getPWMSequenceTop() (always high).
+ * @param length the number of values.
+ * @param loop true to play the sequence over and over until stopPWMSequence() is called.
+ *
+ * @return DEVICE_OK, DEVICE_INVALID_PARAMETER if there are no values, DEVICE_NO_RESOURCES if
+ *         there's no DMA channel to use, or DEVICE_NOT_SUPPORTED if the given pin does not have
+ *         analog capability.
+ */
+int ZPin::playPWMSequence(const uint16_t *values, int length, bool loop)
+{
+    if (values == NULL || length <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    volatile uint16_t *reg;
+    int r = preparePWMSequence(reg);
+    if (r < 0)
+        return r;
+
+    if (pwmDma == NULL)
+    {
+        pwmDma = DmaFactory::allocate();
+
+        if (pwmDma == NULL)
+            return DEVICE_NO_RESOURCES;
+    }
+
+    // one value per overflow of the timer, which loads it at the following one.
+    const pin_timer_t *t = pwmCfg->timer;
+    int trigger = t->is_tc ? tc_overflow_trigger_src(t->index) : tcc_overflow_trigger_src(t->index);
+
+    pwmDma->configure(trigger, BeatHalfWord, NULL, reg);
+    pwmDma->onTransferComplete(pwm_sequence_handler, this);
+
+    if (loop)
+        pwmDma->startCircular((void *)values, length * sizeof(uint16_t));
+    else
+        pwmDma->transfer(values, NULL, length * sizeof(uint16_t));
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stops the sequence started by playPWMSequence(), leaving the current duty cycle on the output.
+ *
+ * @return DEVICE_OK, or DEVICE_INVALID_STATE if no sequence was started.
+ */
+int ZPin::stopPWMSequence()
+{
+    if (!(status & IO_STATUS_ANALOG_OUT) || pwmDma == NULL)
+        return DEVICE_INVALID_STATE;
+
+    pwmDma->abort();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Configures this IO pin as an analog/pwm output (if necessary), driven low, and provides the
+ * value of a full duty cycle for playPWMSequence() at the current period.
+ *
+ * @return the value, or DEVICE_NOT_SUPPORTED if the given pin does not have analog capability.
+ */
+int ZPin::getPWMSequenceTop()
+{
+    volatile uint16_t *reg;
+    return preparePWMSequence(reg);
+}
+
 /**
  * Configures this IO pin as an analog/pwm output, and change the output value to the given level.
  *
@@ -338,64 +566,120 @@ int ZPin::setServoValue(int value, int range, int center)
  */
 int ZPin::getAnalogValue()
 {
-    // check if this pin has an analogue mode...
-    if (!(PIN_CAPABILITY_ANALOG & capability))
-        return DEVICE_NOT_SUPPORTED;
+    int value = getAnalogSample();
 
-    const mcu_pin_obj_t* adc_pin = samd_peripherals_get_pin(name);
-    uint8_t channel = adc_pin->adc_input[0];
-#ifdef SAMD21
-    Adc *adc = ADC;
-#else
-    Adc *adc = ADC0;
-    if (channel == 0xff) {
-        adc = ADC1;
-        channel = adc_pin->adc_input[1];
-    }
-#endif
+    if (value < 0 || adcCfg == NULL)
+        return value;
 
-    if (channel == 0xff)
+    // scale to the usual 10 bits.
+    if (adcCfg->resolution > 10)
+        return value >> (adcCfg->resolution - 10);
+
+    return value << (10 - adcCfg->resolution);
+}
+
+/**
+ * Sets how this pin is sampled by getAnalogValue() and getAnalogSample().
+ *
+ * @param config the settings to use.
+ *
+ * @return DEVICE_OK, DEVICE_INVALID_PARAMETER if the settings aren't valid, or
+ *         DEVICE_NOT_SUPPORTED if the given pin does not have analog capability.
+ */
+int ZPin::setAnalogConfig(const SAMDADCConfig &config)
+{
+    if (!(PIN_CAPABILITY_ANALOG & capability))
         return DEVICE_NOT_SUPPORTED;
 
-    uint16_t res = 0;
+    if (!SAMDADC::isValid(config))
+        return DEVICE_INVALID_PARAMETER;
 
-    // adc function is B
-    if (!(status & IO_STATUS_ANALOG_IN))
+    if (adcCfg == NULL)
     {
-        disconnect();
-        gpio_set_pin_function(name, MUX_B); // mux b is ADC
-        status = IO_STATUS_ANALOG_IN;
+        target_disable_irq();
+        if (analogConfigsUsed < ZPIN_ANALOG_CONFIG_COUNT)
+            adcCfg = &analogConfigs[analogConfigsUsed++];
+        target_enable_irq();
+
+        if (adcCfg == NULL)
+            return DEVICE_NO_RESOURCES;
     }
 
-    // rather than maintain state on many pins, we reconfigure the adc each time it is used.
-    static adc_sync_descriptor adc_descriptor;
+    *adcCfg = config;
 
-    memset(&adc_descriptor, 0, sizeof(adc_descriptor));
+    return DEVICE_OK;
+}
 
-    samd_peripherals_adc_setup(&adc_descriptor, adc);
+/**
+ * Called from the ADC interrupt when a pin watched by setAnalogThresholds() crosses a threshold.
+ */
+static void analog_window_handler(void *arg, bool above)
+{
+    ZPin *pin = (ZPin *)arg;
+    Event(pin->id, above ? DEVICE_PIN_EVT_ANALOG_ABOVE : DEVICE_PIN_EVT_ANALOG_BELOW);
+}
 
-    adc_sync_set_reference(&adc_descriptor, ADC_REFCTRL_REFSEL_INTVCC1_Val);
+/**
+ * Configures this IO pin as an analogue input watched in the background by the ADC's window
+ * monitor, raising DEVICE_PIN_EVT_ANALOG_ABOVE and DEVICE_PIN_EVT_ANALOG_BELOW as the level
+ * crosses the thresholds.
+ *
+ * @param low the lower threshold, in the units of getAnalogSample().
+ * @param high the upper threshold, no less than low.
+ *
+ * @return DEVICE_OK, DEVICE_INVALID_PARAMETER if the thresholds are out of order,
+ *         DEVICE_BUSY if the ADC is streaming or watching another pin, or
+ *         DEVICE_NOT_SUPPORTED if the given pin does not have analog capability.
+ */
+int ZPin::setAnalogThresholds(int low, int high)
+{
+    // putting the pin into analogue mode also tells us if it has one.
+    int r = getAnalogSample();
+    if (r == DEVICE_NOT_SUPPORTED)
+        return r;
 
-#ifdef SAMD21
-    adc_sync_set_channel_gain(&adc_descriptor, channel, ADC_INPUTCTRL_GAIN_DIV2_Val);
-#endif
+    SAMDADC *adc = NULL;
+    int input = SAMDADC::lookup(name, adc);
 
-    adc_sync_set_resolution(&adc_descriptor, ADC_CTRLB_RESSEL_10BIT_Val); // 10 bit conversion
-    adc_sync_enable_channel(&adc_descriptor, channel);
-    adc_sync_set_inputs(&adc_descriptor, channel, ADC_INPUTCTRL_MUXNEG_GND_Val, channel);
+    if (adcCfg)
+        return adc->startWindow(input, *adcCfg, low, high, analog_window_handler, this);
 
-    // first result is always garbaggeeee, according to the datasheet
-    adc_sync_read_channel(&adc_descriptor, channel, (uint8_t*) &res, sizeof(res));
+    return adc->startWindow(input, SAMDADCConfig(), low, high, analog_window_handler, this);
+}
 
-    // returns the number of bytes read.
-    int ret = adc_sync_read_channel(&adc_descriptor, channel, (uint8_t*)&res, sizeof(res));
+/**
+ * Configures this IO pin as an analogue input (if necessary), and samples the Pin at the
+ * resolution given to setAnalogConfig().
+ *
+ * @return the current analogue level on the pin, in the range 0 - (2^resolution - 1),
+ *         DEVICE_BUSY if the ADC is streaming, or DEVICE_NOT_SUPPORTED if the given pin
+ *         does not have analog capability.
+ */
+int ZPin::getAnalogSample()
+{
+    // check if this pin has an analogue mode...
+    if (!(PIN_CAPABILITY_ANALOG & capability))
+        return DEVICE_NOT_SUPPORTED;
 
-    adc_sync_deinit(&adc_descriptor);
+    SAMDADC *adc = NULL;
+    int input = SAMDADC::lookup(name, adc);
 
-    if (ret <= 0)
+    if (input < 0)
         return DEVICE_NOT_SUPPORTED;
 
-    return res;
+    // adc function is B
+    if (!(status & IO_STATUS_ANALOG_IN))
+    {
+        disconnect();
+        gpio_set_pin_function(name, MUX_B); // mux b is ADC
+        status = IO_STATUS_ANALOG_IN;
+    }
+
+    // the ADC only reprograms what differs from the last conversion.
+    if (adcCfg)
+        return adc->read(input, *adcCfg);
+
+    return adc->read(input);
 }
 
 /**
@@ -583,7 +867,12 @@ int ZPin::setPull(PullMode pull)
  */
 void ZPin::pulseWidthEvent(int eventValue)
 {
-    Event evt(id, eventValue, CREATE_ONLY);
+    pulseWidthEvent(eventValue, system_timer_current_time_us());
+}
+
+void ZPin::pulseWidthEvent(int eventValue, CODAL_TIMESTAMP timestamp)
+{
+    Event evt(id, eventValue, timestamp, CREATE_ONLY);
     auto now = evt.timestamp;
     auto previous = this->evCfg->prevPulse;
 
@@ -596,31 +885,87 @@ void ZPin::pulseWidthEvent(int eventValue)
     this->evCfg->prevPulse = now;
 }
 
-#ifdef SAMD21
-extern "C" void EIC_Handler()
+/**
+ * Called from the EIC interrupt when a pin in one of the event modes sees an edge.
+ */
+static void pin_edge_handler(void *arg, bool level)
 {
-    uint32_t extint = EIC->INTFLAG.vec.EXTINT;
-    EIC->INTFLAG.vec.EXTINT = extint;
-    for (uint8_t i = 0; i < 16; i++)
-        if ((extint & (1 << i)) && instances[i])
-            instances[i]->pinEventDetected();
+    ((ZPin *)arg)->edgeDetected(level);
 }
-#endif
 
 void ZPin::pinEventDetected()
 {
-    bool isRise = gpio_get_pin_level(this->name);
+    edgeDetected(fastRead());
+}
+
+void ZPin::edgeDetected(bool isRise)
+{
+#if ZPIN_EDGE_QUEUE_SIZE > 0
+    uint32_t head = edgeHead;
+
+    if (head - edgeTail >= ZPIN_EDGE_QUEUE_SIZE)
+    {
+        edgeOverflows = edgeOverflows + 1;
+        return;
+    }
+
+    ZPinEdge &edge = edgeQueue[head % ZPIN_EDGE_QUEUE_SIZE];
+    edge.pin = this;
+    edge.timestamp = system_timer_current_time_us();
+    edge.level = isRise;
+
+    // the record has to be complete before the fiber can see it.
+    __DMB();
+    edgeHead = head + 1;
 
+    // the fiber only sleeps on an empty queue, so only the first edge of a burst wakes it.
+    if (head == edgeTail)
+        Event(DEVICE_ID_NOTIFY, edgeEventCode);
+#else
+    edgeEvent(isRise, system_timer_current_time_us());
+#endif
+}
+
+void ZPin::edgeEvent(bool isRise, CODAL_TIMESTAMP timestamp)
+{
     if (status & IO_STATUS_EVENT_PULSE_ON_EDGE)
-        pulseWidthEvent(isRise ? DEVICE_PIN_EVT_PULSE_LO : DEVICE_PIN_EVT_PULSE_HI);
+        pulseWidthEvent(isRise ? DEVICE_PIN_EVT_PULSE_LO : DEVICE_PIN_EVT_PULSE_HI, timestamp);
 
     if (status & IO_STATUS_EVENT_ON_EDGE)
-        Event(id, isRise ? DEVICE_PIN_EVT_RISE : DEVICE_PIN_EVT_FALL, 0, CREATE_AND_FIRE);
+        Event(id, isRise ? DEVICE_PIN_EVT_RISE : DEVICE_PIN_EVT_FALL, timestamp, CREATE_AND_FIRE);
 
     if (status & IO_STATUS_INTERRUPT_ON_EDGE)
         this->gpio_irq(isRise);
 }
 
+void ZPin::processEdgeQueue()
+{
+#if ZPIN_EDGE_QUEUE_SIZE > 0
+    uint32_t tail = edgeTail;
+
+    while (tail != edgeHead)
+    {
+        ZPinEdge edge = edgeQueue[tail % ZPIN_EDGE_QUEUE_SIZE];
+
+        // the copy has to be taken before the interrupt can reuse the slot.
+        __DMB();
+        edgeTail = ++tail;
+
+        // a pin that's left the event modes since raises nothing.
+        edge.pin->edgeEvent(edge.level, edge.timestamp);
+    }
+#endif
+}
+
+uint32_t ZPin::getEdgeQueueOverflows()
+{
+#if ZPIN_EDGE_QUEUE_SIZE > 0
+    return edgeOverflows;
+#else
+    return 0;
+#endif
+}
+
 /**
  * This member function will construct an TimedInterruptIn instance, and configure
  * interrupts for rise and fall.
@@ -642,43 +987,25 @@ int ZPin::enableRiseFallEvents(int eventType)
         CODAL_ASSERT(pin != NULL, DEVICE_HARDWARE_CONFIGURATION_ERROR);
         CODAL_ASSERT(pin->has_extint, DEVICE_HARDWARE_CONFIGURATION_ERROR);
 
-        if (!evCfg)
-            evCfg = new ZEventConfig;
+        this->chan = EICFactory::getInstance()->getChannel(pin->extint_channel);
+        CODAL_ASSERT(chan != NULL, DEVICE_HARDWARE_CONFIGURATION_ERROR);
 
-        // this code is optimised for servicing pin interrupts on a slower processor (SAMD21)
-#ifdef SAMD21
+        evCfg = &eventConfigs[pin->extint_channel];
 
-        if (!eic_enabled)
-        {
-            NVIC_SetPriority(EIC_IRQn,0);
-            eic_enabled = true;
-
-            turn_on_external_interrupt_controller();
-            eic_reset();
-            eic_set_enable(true);
-        }
-
-        instances[pin->extint_channel] = this;
-        // last param is ignored as we override EIC_Handlers...
-        // 3 is rise fall
-        turn_on_eic_channel(pin->extint_channel, 3, EIC_HANDLER_APP);
-
-        // pinmux a is zero (true for both samd21 and 51)
-        gpio_set_pin_function(name, PINMUX(name, 0));
-#else
-        if (!chan)
+#if ZPIN_EDGE_QUEUE_SIZE > 0
+        if (edgeEventCode == 0)
         {
-            EICFactory* factory = EICFactory::getInstance();
-            this->chan = factory->getChannel(pin->extint_channel);
-            CODAL_ASSERT(chan != NULL, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+            edgeEventCode = allocateNotifyEvent();
+            create_fiber(edge_queue_fiber);
         }
+#endif
 
         // pinmux a is zero (true for both samd21 and 51)
         gpio_set_pin_function(name, PINMUX(name, 0));
 
-        this->chan->setChangeCallback(this);
+        // the EIC interrupt passes the level it sampled straight to edgeDetected().
+        this->chan->setHandler(pin_edge_handler, this, name);
         this->chan->enable(EICEventsRiseFall);
-#endif
     }
 
     status &= ~(IO_STATUS_EVENT_ON_EDGE | IO_STATUS_EVENT_PULSE_ON_EDGE | IO_STATUS_INTERRUPT_ON_EDGE);
@@ -711,6 +1038,23 @@ int ZPin::disableEvents()
     return DEVICE_OK;
 }
 
+/**
+ * Sets the hardware filtering of edges on this pin, while it's generating events.
+ *
+ * @param filter EICFilterNone, EICFilterMajority to reject glitches of under a few EIC clocks,
+ *        or EICFilterDebounce (SAMD51 only) for mechanical switches.
+ *
+ * @return DEVICE_OK, DEVICE_INVALID_PARAMETER if the pin isn't generating events, or
+ *         DEVICE_NOT_SUPPORTED if the part has no such filter.
+ */
+int ZPin::setEventFilter(EICFilter filter)
+{
+    if (!(status & (IO_STATUS_EVENT_ON_EDGE | IO_STATUS_EVENT_PULSE_ON_EDGE | IO_STATUS_INTERRUPT_ON_EDGE)))
+        return DEVICE_INVALID_PARAMETER;
+
+    return this->chan->setFilter(filter);
+}
+
 /**
  * Configures the events generated by this ZPin instance.
  *
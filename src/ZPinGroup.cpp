@@ -0,0 +1,251 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "ZPinGroup.h"
+#include "CodalFiber.h"
+#include "Event.h"
+#include "CodalDmesg.h"
+#include "codal_target_hal.h"
+#include "tc.h"
+
+extern "C"
+{
+#include "clocks.h"
+#include "timers.h"
+}
+
+#undef ENABLE
+
+using namespace codal;
+
+// notify event used to wake fibers waiting in writeBuffer(), allocated on first use.
+static uint16_t groupEventCode;
+
+/**
+ * Called from the DMA interrupt once writeBuffer() has written everything; the argument
+ * being the status to fill in.
+ */
+static void pin_group_dma_complete(void *arg, DmaCode c)
+{
+    *(volatile int *)arg = c == DMA_COMPLETE ? DEVICE_OK : DEVICE_INVALID_PARAMETER;
+
+    if (groupEventCode)
+        Event(DEVICE_ID_NOTIFY, groupEventCode);
+}
+
+ZPinGroup::ZPinGroup(ZPin **pins, int count)
+{
+    CODAL_ASSERT(count > 0 && count <= ZPIN_GROUP_MAX_PINS, DEVICE_INVALID_PARAMETER);
+
+    this->pins = pins;
+    this->count = count;
+    this->mask = 0;
+    this->dma = NULL;
+    this->writeStatus = DEVICE_OK;
+
+    int port = pins[0]->name / 32;
+    group = &PORT->Group[port];
+
+    bool consecutive = true;
+
+    for (int i = 0; i < count; i++)
+    {
+        CODAL_ASSERT(pins[i]->name / 32 == port, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+
+        bits[i] = pins[i]->name % 32;
+        mask |= 1 << bits[i];
+
+        if (bits[i] != bits[0] + i)
+            consecutive = false;
+    }
+
+    shift = consecutive ? bits[0] : -1;
+}
+
+uint32_t ZPinGroup::toPort(uint32_t value)
+{
+    if (shift >= 0)
+        return (value << shift) & mask;
+
+    uint32_t port = 0;
+
+    for (int i = 0; i < count; i++)
+        if (value & (1 << i))
+            port |= 1 << bits[i];
+
+    return port;
+}
+
+uint32_t ZPinGroup::fromPort(uint32_t port)
+{
+    if (shift >= 0)
+        return (port & mask) >> shift;
+
+    uint32_t value = 0;
+
+    for (int i = 0; i < count; i++)
+        if (port & (1 << bits[i]))
+            value |= 1 << i;
+
+    return value;
+}
+
+void ZPinGroup::setOutput()
+{
+    for (int i = 0; i < count; i++)
+        pins[i]->setDigitalValue(0);
+}
+
+void ZPinGroup::setInput()
+{
+    for (int i = 0; i < count; i++)
+        pins[i]->getDigitalValue();
+}
+
+void ZPinGroup::write(uint32_t value)
+{
+    // toggling only the bits that differ changes all our pins at once, and no one else's.
+    group->OUTTGL.reg = (group->OUT.reg ^ toPort(value)) & mask;
+}
+
+void ZPinGroup::set(uint32_t value)
+{
+    group->OUTSET.reg = toPort(value);
+}
+
+void ZPinGroup::clear(uint32_t value)
+{
+    group->OUTCLR.reg = toPort(value);
+}
+
+uint32_t ZPinGroup::read()
+{
+    return fromPort(group->IN.reg);
+}
+
+int ZPinGroup::writeBuffer(const uint8_t *data, int len, int frequency)
+{
+    if (shift < 0 || (shift & 7) || count > 8)
+        return DEVICE_NOT_SUPPORTED;
+
+    if (len <= 0 || frequency <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    // make sure the data is not on the stack, which other fibers use while we sleep.
+    uint8_t getSP = 0;
+    CODAL_ASSERT(data < &getSP, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+
+    // the slowest prescaler that still gives the rate, as a power of two: DIV1 to DIV1024.
+    static const uint8_t prescaler_shifts[] = { 0, 1, 2, 3, 4, 6, 8, 10 };
+    uint32_t prescaler = 0;
+    uint32_t period = 8000000 / frequency;
+
+    while (period > 0x10000 && prescaler < 7)
+        period = (8000000 >> prescaler_shifts[++prescaler]) / frequency;
+
+    // the timer needs at least two ticks per write, and at most 0x10000.
+    if (period < 2 || period > 0x10000)
+        return DEVICE_INVALID_PARAMETER;
+
+    Tc *tc = ZPIN_GROUP_TC;
+    uint8_t tc_index = 0;
+    while (tc_index < TC_INST_NUM)
+    {
+        if (tc_insts[tc_index] == tc)
+            break;
+        tc_index++;
+    }
+    CODAL_ASSERT(tc_index < TC_INST_NUM, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+
+    if (dma == NULL)
+    {
+        dma = DmaFactory::allocate();
+
+        if (dma == NULL)
+            return DEVICE_NO_RESOURCES;
+
+        // one byte of OUT per timer overflow.
+        dma->configure(tc_overflow_trigger_src(tc_index), BeatByte, NULL, (uint8_t *)&group->OUT.reg + shift / 8);
+    }
+
+    bool sleep = __get_IPSR() == 0 && fiber_scheduler_running();
+
+    if (sleep && groupEventCode == 0)
+        groupEventCode = allocateNotifyEvent();
+
+    // the interrupt reports back through a member: our stack is swapped out while we sleep.
+    writeStatus = DEVICE_BUSY;
+    dma->onTransferComplete(pin_group_dma_complete, (void *)&writeStatus);
+
+    // Use a timer to pace the writes. Nothing hands the timers out, so at least make sure
+    // no one else is running this one.
+    CODAL_ASSERT(!tc->COUNT16.CTRLA.bit.ENABLE, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+    tc_set_enable(tc, false);
+    turn_on_clocks(true, tc_index, CLK_GEN_8MHZ);
+    tc_reset(tc);
+
+    tc->COUNT16.CTRLA.bit.MODE = 0;
+#ifdef SAMD51
+    tc->COUNT16.WAVE.reg = TC_WAVE_WAVEGEN_MFRQ;
+#endif
+#ifdef SAMD21
+    tc->COUNT16.CTRLA.bit.WAVEGEN = TC_CTRLA_WAVEGEN_MFRQ_Val;
+#endif
+    tc->COUNT16.CTRLA.bit.PRESCALER = prescaler;
+    tc->COUNT16.CTRLBCLR.bit.DIR = 1; // count up
+
+    // the timer counts from 0 to CC0 inclusive.
+    tc->COUNT16.CC[0].reg = period - 1;
+
+    dma->transfer(data, NULL, len);
+    tc_set_enable(tc, true);
+
+    if (sleep)
+    {
+        target_disable_irq();
+        while (writeStatus == DEVICE_BUSY)
+        {
+            fiber_wake_on_event(DEVICE_ID_NOTIFY, groupEventCode);
+            target_enable_irq();
+            schedule();
+            target_disable_irq();
+        }
+        target_enable_irq();
+    }
+    else
+    {
+        while (writeStatus == DEVICE_BUSY);
+    }
+
+    tc_set_enable(tc, false);
+    dma->onTransferComplete(NULL, NULL);
+
+    return writeStatus;
+}
+
+ZPinGroup::~ZPinGroup()
+{
+    if (dma)
+        delete dma;
+}
@@ -0,0 +1,119 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "ZPulseCapture.h"
+#include "SAMDEIC.h"
+#include "CodalDmesg.h"
+#include "codal_target_hal.h"
+#include "pinmap.h"
+#include "hal_gpio.h"
+#include "tc.h"
+
+extern "C"
+{
+#include "clocks.h"
+#include "timers.h"
+}
+
+#undef ENABLE
+
+using namespace codal;
+
+ZPulseCapture::ZPulseCapture(ZPin &pin, ZPulseCaptureLevel level, Tc *tc) : pin(pin)
+{
+    this->tc = tc;
+
+    uint8_t tc_index = 0;
+    while (tc_index < TC_INST_NUM)
+    {
+        if (tc_insts[tc_index] == tc)
+            break;
+        tc_index++;
+    }
+    CODAL_ASSERT(tc_index < TC_INST_NUM, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+
+    const mcu_pin_obj_t *mcuPin = samd_peripherals_get_pin(pin.name);
+    CODAL_ASSERT(mcuPin != NULL && mcuPin->has_extint, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+    extint = mcuPin->extint_channel;
+
+    // the pin is an input, handed to the EIC (function A).
+    pin.getDigitalValue();
+    gpio_set_pin_function(pin.name, PINMUX(pin.name, 0));
+
+    // the timer counts microseconds, restarting at each start of a pulse. CC0 latches the
+    // period and CC1 the pulse width (PPW), the event being inverted to time low pulses.
+    // nothing hands the timers out, so at least make sure no one else is running this one.
+    CODAL_ASSERT(!tc->COUNT16.CTRLA.bit.ENABLE, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+    tc_set_enable(tc, false);
+    turn_on_clocks(true, tc_index, CLK_GEN_8MHZ);
+    tc_reset(tc);
+
+    uint16_t evctrl = TC_EVCTRL_TCEI | TC_EVCTRL_EVACT_PPW | (level == PulseCaptureLow ? TC_EVCTRL_TCINV : 0);
+
+#ifdef SAMD21
+    tc->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 | TC_CTRLA_PRESCALER_DIV8;
+    tc->COUNT16.CTRLC.reg = TC_CTRLC_CPTEN0 | TC_CTRLC_CPTEN1;
+#else
+    tc->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 | TC_CTRLA_PRESCALER_DIV8 | TC_CTRLA_CAPTEN0 | TC_CTRLA_CAPTEN1;
+#endif
+    tc->COUNT16.EVCTRL.reg = evctrl;
+    tc->COUNT16.INTFLAG.reg = TC_INTFLAG_MC0 | TC_INTFLAG_MC1;
+
+    tc_set_enable(tc, true);
+
+    // the EIC passes the pin's level on as the event.
+    int r = eic_enable_level_event(extint);
+    CODAL_ASSERT(r == DEVICE_OK, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+
+    evsys = EvsysFactory::allocate();
+    CODAL_ASSERT(evsys != NULL, DEVICE_NO_RESOURCES);
+
+    evsys->setGenerator(eic_event_gen(extint), EvsysPathAsync);
+    evsys->addUser(tc_event_user(tc_index));
+}
+
+int ZPulseCapture::read(uint32_t &period, uint32_t &width)
+{
+    // the width is latched when a pulse ends, after the period at its start.
+    bool captured = tc->COUNT16.INTFLAG.bit.MC1;
+
+    if (captured)
+        tc->COUNT16.INTFLAG.reg = TC_INTFLAG_MC0 | TC_INTFLAG_MC1;
+
+    period = tc->COUNT16.CC[0].reg;
+    width = tc->COUNT16.CC[1].reg;
+
+    return captured ? DEVICE_OK : DEVICE_BUSY;
+}
+
+ZPulseCapture::~ZPulseCapture()
+{
+    delete evsys;
+
+    eic_disable_level_event(extint);
+
+    tc_set_enable(tc, false);
+    tc_reset(tc);
+}
@@ -0,0 +1,123 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "ZPulseCounter.h"
+#include "SAMDEIC.h"
+#include "CodalDmesg.h"
+#include "pinmap.h"
+#include "hal_gpio.h"
+#include "tc.h"
+
+extern "C"
+{
+#include "clocks.h"
+#include "timers.h"
+}
+
+#undef ENABLE
+
+using namespace codal;
+
+ZPulseCounter::ZPulseCounter(ZPin &pin, EvsysEdge edge, Tc *tc)
+{
+    CODAL_ASSERT(edge != EvsysEdgeNone, DEVICE_INVALID_PARAMETER);
+
+    this->tc = tc;
+
+    uint8_t tc_index = 0;
+    while (tc_index < TC_INST_NUM)
+    {
+        if (tc_insts[tc_index] == tc)
+            break;
+        tc_index++;
+    }
+    CODAL_ASSERT(tc_index < TC_INST_NUM, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+
+    const mcu_pin_obj_t *mcuPin = samd_peripherals_get_pin(pin.name);
+    CODAL_ASSERT(mcuPin != NULL && mcuPin->has_extint, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+    extint = mcuPin->extint_channel;
+
+    // the pin is an input, handed to the EIC (function A).
+    pin.getDigitalValue();
+    gpio_set_pin_function(pin.name, PINMUX(pin.name, 0));
+
+    // the timer counts events rather than clock ticks; the clock only drives its logic.
+    // nothing hands the timers out, so at least make sure no one else is running this one.
+    CODAL_ASSERT(!tc->COUNT16.CTRLA.bit.ENABLE, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+    tc_set_enable(tc, false);
+    turn_on_clocks(true, tc_index, CLK_GEN_8MHZ);
+    tc_reset(tc);
+
+    tc->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16;
+    tc->COUNT16.EVCTRL.reg = TC_EVCTRL_TCEI | TC_EVCTRL_EVACT_COUNT;
+
+    tc_set_enable(tc, true);
+
+    // the EIC passes the pin's level on, and the event channel turns the chosen edges of it
+    // into one event each.
+    int r = eic_enable_level_event(extint);
+    CODAL_ASSERT(r == DEVICE_OK, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+
+    evsys = EvsysFactory::allocate(true);
+    CODAL_ASSERT(evsys != NULL, DEVICE_NO_RESOURCES);
+
+    evsys->setGenerator(eic_event_gen(extint), EvsysPathResync, edge);
+    evsys->addUser(tc_event_user(tc_index));
+}
+
+uint32_t ZPulseCounter::read()
+{
+#ifdef SAMD21
+    tc->COUNT16.READREQ.bit.ADDR = 0x10;
+    tc->COUNT16.READREQ.bit.RREQ = 1;
+    while (tc->COUNT16.STATUS.bit.SYNCBUSY);
+#else
+    // the command clears itself once COUNT has been brought up to date.
+    tc->COUNT16.CTRLBSET.reg = TC_CTRLBSET_CMD_READSYNC;
+    while (tc->COUNT16.SYNCBUSY.bit.CTRLB || tc->COUNT16.CTRLBSET.bit.CMD);
+#endif
+
+    return tc->COUNT16.COUNT.reg;
+}
+
+void ZPulseCounter::reset()
+{
+    tc->COUNT16.COUNT.reg = 0;
+#ifdef SAMD21
+    while (tc->COUNT16.STATUS.bit.SYNCBUSY);
+#else
+    while (tc->COUNT16.SYNCBUSY.reg != 0);
+#endif
+}
+
+ZPulseCounter::~ZPulseCounter()
+{
+    delete evsys;
+
+    eic_disable_level_event(extint);
+
+    tc_set_enable(tc, false);
+    tc_reset(tc);
+}
@@ -0,0 +1,163 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "ZQuadratureCounter.h"
+#include "SAMDEIC.h"
+#include "CodalDmesg.h"
+#include "pinmap.h"
+#include "hal_gpio.h"
+#include "pwmout_api.h"
+
+extern "C"
+{
+#include "clocks.h"
+#include "timers.h"
+}
+
+#undef ENABLE
+
+using namespace codal;
+
+/**
+ * Hands a pin to the EIC, which passes its level on to the event system.
+ *
+ * @return the pin's EIC line.
+ */
+static int attach_pin(ZPin &pin)
+{
+    const mcu_pin_obj_t *mcuPin = samd_peripherals_get_pin(pin.name);
+    CODAL_ASSERT(mcuPin != NULL && mcuPin->has_extint, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+
+    // the pin is an input, handed to the EIC (function A).
+    pin.getDigitalValue();
+    gpio_set_pin_function(pin.name, PINMUX(pin.name, 0));
+
+    int r = eic_enable_level_event(mcuPin->extint_channel);
+    CODAL_ASSERT(r == DEVICE_OK, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+
+    return mcuPin->extint_channel;
+}
+
+ZQuadratureCounter::ZQuadratureCounter(ZPin &a, ZPin &b)
+{
+    extintA = attach_pin(a);
+    extintB = attach_pin(b);
+
+#ifdef SAMD21
+    int r = pwmout_claim_tcc(ZQUADRATURE_COUNTER_TCC);
+    CODAL_ASSERT(r == 0, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+
+    tcc = tcc_insts[ZQUADRATURE_COUNTER_TCC];
+
+    // the counter steps on each rising edge of A, in the direction given by the level of B.
+    // The TCC can't combine A's level into the direction, so this is X1 and doesn't cancel
+    // out chatter on A, see ZQuadratureCounter.h.
+    turn_on_clocks(false, ZQUADRATURE_COUNTER_TCC, CLK_GEN_8MHZ);
+    tcc_set_enable(tcc, false);
+    tcc->CTRLA.bit.SWRST = 1;
+    while (tcc->SYNCBUSY.bit.SWRST);
+
+    tcc->EVCTRL.reg = TCC_EVCTRL_TCEI0 | TCC_EVCTRL_EVACT0_COUNTEV | TCC_EVCTRL_TCEI1 | TCC_EVCTRL_EVACT1_DIR;
+    tcc_set_enable(tcc, true);
+
+    evsysA = EvsysFactory::allocate(true);
+    evsysB = EvsysFactory::allocate();
+    CODAL_ASSERT(evsysA != NULL && evsysB != NULL, DEVICE_NO_RESOURCES);
+
+    evsysA->setGenerator(eic_event_gen(extintA), EvsysPathResync, EvsysEdgeRise);
+    evsysA->addUser(tcc_event_user(ZQUADRATURE_COUNTER_TCC, 0));
+    evsysB->setGenerator(eic_event_gen(extintB), EvsysPathAsync);
+    evsysB->addUser(tcc_event_user(ZQUADRATURE_COUNTER_TCC, 1));
+#else
+    // the decoder takes both signals as levels, from events rather than its own pins.
+    MCLK->APBCMASK.bit.PDEC_ = 1;
+    connect_gclk_to_peripheral(CLK_GEN_8MHZ, PDEC_GCLK_ID);
+
+    PDEC->CTRLA.bit.SWRST = 1;
+    while (PDEC->SYNCBUSY.bit.SWRST);
+
+    PDEC->CTRLA.reg = PDEC_CTRLA_MODE_QDEC | PDEC_CTRLA_CONF_X4 | PDEC_CTRLA_ANGULAR(7);
+    PDEC->EVCTRL.reg = PDEC_EVCTRL_EVEI(3);
+
+    PDEC->CTRLA.bit.ENABLE = 1;
+    while (PDEC->SYNCBUSY.bit.ENABLE);
+
+    PDEC->CTRLBSET.reg = PDEC_CTRLBSET_CMD_START;
+    while (PDEC->SYNCBUSY.bit.CTRLB);
+
+    evsysA = EvsysFactory::allocate();
+    evsysB = EvsysFactory::allocate();
+    CODAL_ASSERT(evsysA != NULL && evsysB != NULL, DEVICE_NO_RESOURCES);
+
+    evsysA->setGenerator(eic_event_gen(extintA), EvsysPathAsync);
+    evsysA->addUser(EVSYS_ID_USER_PDEC_EVU_0);
+    evsysB->setGenerator(eic_event_gen(extintB), EvsysPathAsync);
+    evsysB->addUser(EVSYS_ID_USER_PDEC_EVU_1);
+#endif
+}
+
+int32_t ZQuadratureCounter::read()
+{
+#ifdef SAMD21
+    // the command clears itself once COUNT has been brought up to date.
+    tcc->CTRLBSET.reg = TCC_CTRLBSET_CMD_READSYNC;
+    while (tcc->SYNCBUSY.bit.CTRLB || tcc->CTRLBSET.bit.CMD);
+
+    // sign extend the 24 bit count.
+    return ((int32_t)(tcc->COUNT.reg << 8)) >> 8;
+#else
+    PDEC->CTRLBSET.reg = PDEC_CTRLBSET_CMD_READSYNC;
+    while (PDEC->SYNCBUSY.bit.CTRLB || PDEC->CTRLBSET.bit.CMD);
+
+    return (int16_t)PDEC->COUNT.reg;
+#endif
+}
+
+void ZQuadratureCounter::reset()
+{
+#ifdef SAMD21
+    tcc->COUNT.reg = 0;
+    while (tcc->SYNCBUSY.bit.COUNT);
+#else
+    PDEC->COUNT.reg = 0;
+    while (PDEC->SYNCBUSY.bit.COUNT);
+#endif
+}
+
+ZQuadratureCounter::~ZQuadratureCounter()
+{
+    delete evsysA;
+    delete evsysB;
+
+    eic_disable_level_event(extintA);
+    eic_disable_level_event(extintB);
+
+#ifdef SAMD21
+    pwmout_release_tcc(ZQUADRATURE_COUNTER_TCC);
+#else
+    PDEC->CTRLA.bit.ENABLE = 0;
+    while (PDEC->SYNCBUSY.bit.ENABLE);
+#endif
+}
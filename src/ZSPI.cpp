@@ -208,28 +208,34 @@ void ZSPI::init()
         if (!sercom)
             target_panic(903);
 
+        CODAL_ASSERT(mosi != NULL, DEVICE_HARDWARE_CONFIGURATION_ERROR);
+
         DmaFactory factory;
 
-        if (miso)
+        dmaRxCh = miso ? factory.allocate() : NULL;
+        dmaTxCh = mosi ? factory.allocate() : NULL;
+
+        // out of DMA channels; transfers will fail with DEVICE_NO_RESOURCES.
+        if ((miso && !dmaRxCh) || (mosi && !dmaTxCh))
+        {
+            DMESG("SPI: no DMA channels");
+            delete dmaRxCh;
+            delete dmaTxCh;
+            dmaRxCh = NULL;
+            dmaTxCh = NULL;
+        }
+
+        if (dmaRxCh)
         {
-            dmaRxCh = factory.allocate();
             dmaRxCh->configure(sercom_trigger_src(sercomIdx, false), BeatByte,
                                &sercom->SPI.DATA.reg, NULL);
         }
-        else
-            dmaRxCh = NULL;
 
-        if (mosi)
+        if (dmaTxCh)
         {
-            dmaTxCh = factory.allocate();
             dmaTxCh->configure(sercom_trigger_src(sercomIdx, true), BeatByte, NULL,
                                &sercom->SPI.DATA.reg);
-            dmaTxCh->onTransferComplete(this);
-        }
-        else
-        {
-            CODAL_ASSERT(0, DEVICE_HARDWARE_CONFIGURATION_ERROR);
-            dmaTxCh = NULL;
+            dmaTxCh->onTransferComplete(dma_member_handler<ZSPI>, this);
         }
     }
 
@@ -304,6 +310,11 @@ int ZSPI::transfer(const uint8_t *txBuffer, uint32_t txSize, uint8_t *rxBuffer,
     if (txSize == 0 && rxSize == 0)
         return 0; // nothing to do
 
+    // fail before we commit to waiting for a completion event that would never come.
+    init();
+    if (dmaTxCh == NULL)
+        return DEVICE_NO_RESOURCES;
+
     fiber_wake_on_event(DEVICE_ID_NOTIFY, transferCompleteEventCode);
     auto res = startTransfer(txBuffer, txSize, rxBuffer, rxSize, NULL, NULL);
     LOG("SPI ->");
@@ -317,6 +328,9 @@ int ZSPI::startTransfer(const uint8_t *txBuffer, uint32_t txSize, uint8_t *rxBuf
 {
     init();
 
+    if (dmaTxCh == NULL)
+        return DEVICE_NO_RESOURCES;
+
     LOG("SPI start %p/%d %p/%d D=%p", txBuffer, txSize, rxBuffer, rxSize, doneHandler);
 
     // make sure buffers are not on the stack
@@ -4,6 +4,7 @@
 #include "Event.h"
 #include "dma.h"
 #include "CodalFiber.h"
+#include "Timer.h"
 
 #include "driver_init.h"
 #include "peripheral_clk_config.h"
@@ -17,6 +18,8 @@ using namespace codal;
 
 #define TX_CONFIGURED       0x02
 #define RX_CONFIGURED       0x04
+#define RX_DMA_PENDING      0x08
+#define RX_BREAK            0x10
 
 #define LOG DMESG
 
@@ -26,9 +29,18 @@ static ZSingleWireSerial* sws_instance = NULL;
 
 static void error_callback(struct _usart_async_device *device)
 {
+    if (!sws_instance)
+        return;
+
+    // a framing error may be a break, rather than a corrupt frame.
+    if (((Sercom*)device->hw)->USART.STATUS.bit.FERR)
+    {
+        sws_instance->breakDetected();
+        return;
+    }
+
     // flag any error to the dma handler.
-    if (sws_instance)
-        sws_instance->dmaTransferComplete(DMA_ERROR);
+    sws_instance->dmaTransferComplete(DMA_ERROR);
 }
 
 static void tx_callback(struct _usart_async_device *)
@@ -44,6 +56,8 @@ void ZSingleWireSerial::dmaTransferComplete(DmaCode errCode)
 {
     uint16_t mode = 0;
 
+    status &= ~RX_DMA_PENDING;
+
     if (errCode == DMA_COMPLETE)
     {
         if (status & TX_CONFIGURED)
@@ -104,6 +118,8 @@ ZSingleWireSerial::ZSingleWireSerial(Pin& p) : DMASingleWireSerial(p)
     DMESG("SWS pad %d, idx %d, fn: %d", 0, this->instance_number, this->pinmux);
 
     this->id = DEVICE_ID_SERIAL;
+    this->rxBuf = NULL;
+    this->rxBreakBytes = 0;
     sws_instance = this;
 
     memset(&USART_INSTANCE, 0, sizeof(USART_INSTANCE));
@@ -120,14 +136,24 @@ ZSingleWireSerial::ZSingleWireSerial(Pin& p) : DMASingleWireSerial(p)
     DmaFactory factory;
     usart_tx_dma = factory.allocate();
     usart_rx_dma = factory.allocate();
-    CODAL_ASSERT(usart_tx_dma != NULL, DEVICE_HARDWARE_CONFIGURATION_ERROR);
-    CODAL_ASSERT(usart_rx_dma != NULL, DEVICE_HARDWARE_CONFIGURATION_ERROR);
 
-    usart_tx_dma->onTransferComplete(this);
-    usart_rx_dma->onTransferComplete(this);
+    // out of DMA channels; the DMA calls will fail with DEVICE_NO_RESOURCES.
+    if (usart_tx_dma == NULL || usart_rx_dma == NULL)
+    {
+        DMESG("SWS: no DMA channels");
+        delete usart_tx_dma;
+        delete usart_rx_dma;
+        usart_tx_dma = NULL;
+        usart_rx_dma = NULL;
+    }
+    else
+    {
+        usart_tx_dma->onTransferComplete(dma_member_handler<ZSingleWireSerial>, this);
+        usart_rx_dma->onTransferComplete(dma_member_handler<ZSingleWireSerial>, this);
 
-    usart_tx_dma->configure(sercom_trigger_src(this->instance_number, true), BeatByte, NULL, (volatile void*)&CURRENT_USART->USART.DATA.reg);
-    usart_rx_dma->configure(sercom_trigger_src(this->instance_number, false), BeatByte, (volatile void*)&CURRENT_USART->USART.DATA.reg, NULL);
+        usart_tx_dma->configure(sercom_trigger_src(this->instance_number, true), BeatByte, NULL, (volatile void*)&CURRENT_USART->USART.DATA.reg);
+        usart_rx_dma->configure(sercom_trigger_src(this->instance_number, false), BeatByte, (volatile void*)&CURRENT_USART->USART.DATA.reg, NULL);
+    }
 
     setBaud(115200);
     
@@ -308,6 +334,9 @@ int ZSingleWireSerial::receive(uint8_t* data, int len)
 
 int ZSingleWireSerial::sendDMA(uint8_t* data, int len)
 {
+    if (usart_tx_dma == NULL)
+        return DEVICE_NO_RESOURCES;
+
     if (!(status & RX_CONFIGURED))
         setMode(SingleWireTx);
 
@@ -317,9 +346,16 @@ int ZSingleWireSerial::sendDMA(uint8_t* data, int len)
 
 int ZSingleWireSerial::receiveDMA(uint8_t* data, int len)
 {
+    if (usart_rx_dma == NULL)
+        return DEVICE_NO_RESOURCES;
+
     if (!(status & RX_CONFIGURED))
         setMode(SingleWireRx);
 
+    rxBuf = data;
+    status &= ~RX_BREAK;
+    status |= RX_DMA_PENDING;
+
     usart_rx_dma->transfer(NULL, data, len);
 
     return DEVICE_OK;
@@ -330,6 +366,12 @@ int ZSingleWireSerial::getBytesReceived()
     if (!(status & RX_CONFIGURED))
         return DEVICE_INVALID_STATE;
 
+    if (status & RX_BREAK)
+        return rxBreakBytes;
+
+    if (usart_rx_dma == NULL)
+        return DEVICE_NO_RESOURCES;
+
     return usart_rx_dma->getBytesTransferred();
 }
 
@@ -338,6 +380,9 @@ int ZSingleWireSerial::getBytesTransmitted()
     if (!(status & TX_CONFIGURED))
         return DEVICE_INVALID_STATE;
 
+    if (usart_tx_dma == NULL)
+        return DEVICE_NO_RESOURCES;
+
     return usart_tx_dma->getBytesTransferred();
 }
 
@@ -346,9 +391,14 @@ int ZSingleWireSerial::abortDMA()
     if (!(status & (RX_CONFIGURED | TX_CONFIGURED)))
         return DEVICE_INVALID_PARAMETER;
 
+    if (usart_tx_dma == NULL)
+        return DEVICE_NO_RESOURCES;
+
     usart_tx_dma->abort();
     usart_rx_dma->abort();
 
+    status &= ~RX_DMA_PENDING;
+
     // abort dma transfer
     return DEVICE_OK;
 }
@@ -358,6 +408,54 @@ int ZSingleWireSerial::sendBreak()
     if (!(status & TX_CONFIGURED))
         return DEVICE_INVALID_PARAMETER;
 
-    // line break
+    // one bit period, rounded up to the next microsecond.
+    uint32_t bitTime = (1000000 + baud - 1) / baud;
+
+    // once DRE is set, at most one frame can still be in the shift register.
+    while(!(CURRENT_USART->USART.INTFLAG.bit.DRE));
+
+    if (!(CURRENT_USART->USART.INTFLAG.bit.TXC))
+        system_timer_wait_us(bitTime * 10);
+
+    // take the pin away from the sercom and hold the line low for the duration of the break.
+    gpio_set_pin_level(p.name, 0);
+    gpio_set_pin_direction(p.name, GPIO_DIRECTION_OUT);
+    gpio_set_pin_function(p.name, GPIO_PIN_FUNCTION_OFF);
+
+    system_timer_wait_us(bitTime * SWS_BREAK_BIT_TIMES);
+
+    // hand the pin back, the sercom idles the line high until the next frame.
+    gpio_set_pin_function(p.name, this->pinmux);
+    gpio_set_pin_direction(p.name, GPIO_DIRECTION_IN);
+
     return DEVICE_OK;
 }
+
+void ZSingleWireSerial::breakDetected()
+{
+    // a break holds the line low beyond the stop bit, anything else is a genuine framing error.
+    if (gpio_get_pin_level(p.name))
+    {
+        dmaTransferComplete(DMA_ERROR);
+        return;
+    }
+
+    if (!(status & RX_DMA_PENDING))
+        return;
+
+    usart_rx_dma->abort();
+
+    int len = usart_rx_dma->getBytesTransferred();
+
+    // the break itself is received as a byte with a framing error. If the receiver still holds
+    // it, dma never read it and it's simply discarded; otherwise it's the last byte dma stored.
+    if (CURRENT_USART->USART.INTFLAG.bit.RXC)
+        (void)CURRENT_USART->USART.DATA.reg;
+    else if (len > 0)
+        len--;
+
+    rxBreakBytes = len;
+    status |= RX_BREAK;
+
+    dmaTransferComplete(DMA_COMPLETE);
+}
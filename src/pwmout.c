@@ -328,6 +328,8 @@ void common_hal_pulseio_pwmout_deinit(pulseio_pwmout_obj_t *self)
         tcc_channels[t->index] &= ~(1 << tcc_channel(t));
         if (tcc_refcount[t->index] == 0)
         {
+            // a variable frequency output claimed every channel.
+            tcc_channels[t->index] = 0xff << tcc_cc_num[t->index];
             target_tcc_frequencies[t->index] = 0;
             Tcc *tcc = tcc_insts[t->index];
             tcc_set_enable(tcc, false);
@@ -431,22 +433,13 @@ uint16_t common_hal_pulseio_pwmout_get_duty_cycle(pulseio_pwmout_obj_t *self)
     }
 }
 
-int common_hal_pulseio_pwmout_set_frequency(pulseio_pwmout_obj_t *self, uint32_t frequency)
+static int set_frequency_resolution(pulseio_pwmout_obj_t *self, uint32_t frequency, uint8_t resolution)
 {
     if (frequency == 0 || frequency > 6000000)
     {
         return -2; // "Invalid PWM frequency"
     }
     const pin_timer_t *t = self->timer;
-    uint8_t resolution;
-    if (t->is_tc)
-    {
-        resolution = 16;
-    }
-    else
-    {
-        resolution = 24;
-    }
     uint32_t system_clock = common_hal_mcu_processor_get_frequency();
     uint32_t new_top;
     uint8_t new_divisor;
@@ -509,6 +502,11 @@ int common_hal_pulseio_pwmout_set_frequency(pulseio_pwmout_obj_t *self, uint32_t
     return 0;
 }
 
+int common_hal_pulseio_pwmout_set_frequency(pulseio_pwmout_obj_t *self, uint32_t frequency)
+{
+    return set_frequency_resolution(self, frequency, self->timer->is_tc ? 16 : 24);
+}
+
 uint32_t common_hal_pulseio_pwmout_get_frequency(pulseio_pwmout_obj_t *self)
 {
     uint32_t system_clock = common_hal_mcu_processor_get_frequency();
@@ -563,3 +561,68 @@ int pwmout_write(pwmout_t *obj, uint32_t pulse, uint32_t period)
     obj->pulse = pulse;
     return common_hal_pulseio_pwmout_set_duty_cycle(obj, DUTY(obj));
 }
+
+int pwmout_compare_register(pwmout_t *obj, volatile uint16_t **reg)
+{
+    const pin_timer_t *t = obj->timer;
+    if (!obj->pin)
+        return -100;
+
+    // 16 bit writes only reach the bottom of a TCC's compare registers.
+    if (!t->is_tc && tcc_periods[t->index] > 0xffff)
+    {
+        int r = set_frequency_resolution(obj, FREQ(obj), 16);
+        if (r)
+            return r;
+    }
+
+    common_hal_pulseio_pwmout_set_duty_cycle(obj, 0);
+
+    if (t->is_tc)
+    {
+        Tc *tc = tc_insts[t->index];
+#ifdef SAMD21
+        *reg = &tc->COUNT16.CC[t->wave_output].reg;
+#endif
+#ifdef SAMD51
+        *reg = &tc->COUNT16.CCBUF[1].reg;
+#endif
+        return tc_periods[t->index];
+    }
+
+    Tcc *tcc = tcc_insts[t->index];
+    uint8_t channel = tcc_channel(t);
+#ifdef SAMD21
+    *reg = (volatile uint16_t *)&tcc->CCB[channel].reg;
+#endif
+#ifdef SAMD51
+    *reg = (volatile uint16_t *)&tcc->CCBUF[channel].reg;
+#endif
+    return tcc_periods[t->index];
+}
+
+int pwmout_claim_tcc(uint8_t index)
+{
+    Tcc *tcc = tcc_insts[index];
+    if (tcc_refcount[index] != 0 || tcc->CTRLA.bit.ENABLE == 1)
+        return -1;
+
+    tcc_refcount[index]++;
+    tcc_channels[index] = 0xff;
+    target_tcc_frequencies[index] = 0;
+    return 0;
+}
+
+void pwmout_release_tcc(uint8_t index)
+{
+    Tcc *tcc = tcc_insts[index];
+    tcc_set_enable(tcc, false);
+    tcc->CTRLA.bit.SWRST = true;
+    while (tcc->SYNCBUSY.bit.SWRST != 0)
+    {
+        /* Wait for sync */
+    }
+
+    tcc_refcount[index] = 0;
+    tcc_channels[index] = 0xff << tcc_cc_num[index];
+}